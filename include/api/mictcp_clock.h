@@ -0,0 +1,47 @@
+#ifndef MICTCP_CLOCK_H
+#define MICTCP_CLOCK_H
+
+#include <time.h>
+
+/*****************************************************************
+ * Protocol clock                                                *
+ *                                                               *
+ * Microseconds on CLOCK_MONOTONIC: RTT samples and timeouts do  *
+ * not jump with NTP steps or date changes. On x86-64 with an    *
+ * invariant TSC, the clock can read the TSC instead, scaled by  *
+ * a fixed-point factor calibrated against CLOCK_MONOTONIC (one  *
+ * rdtsc and one multiply, no system call). The coarse clock is  *
+ * the value published by the last mictcp_clock_tick(), which    *
+ * event loops call once per iteration: reading it is a plain    *
+ * load.                                                         *
+ *****************************************************************/
+
+#define MICTCP_CLOCK_CALIBRATION 20 /* ms spent measuring the TSC rate */
+
+extern unsigned long mictcp_clock_coarse;
+
+unsigned long mictcp_clock_usec(void);
+
+/* Switches to the TSC (calibrated on first use) or back to CLOCK_MONOTONIC.
+   Returns -1 if the TSC is missing or not invariant */
+int mictcp_clock_use_tsc(int enabled);
+
+/* TSC ticks per second, 0 until calibrated */
+double mictcp_clock_tsc_hz(void);
+
+/* Publishes the current time for mictcp_clock_coarse_usec() */
+static inline void mictcp_clock_tick(void)
+{
+    __atomic_store_n(&mictcp_clock_coarse, mictcp_clock_usec(), __ATOMIC_RELAXED);
+}
+
+static inline unsigned long mictcp_clock_coarse_usec(void)
+{
+    return __atomic_load_n(&mictcp_clock_coarse, __ATOMIC_RELAXED);
+}
+
+/* Absolute CLOCK_MONOTONIC time usec from now, for waits on a condition
+   variable or semaphore using that clock */
+void mictcp_clock_deadline(struct timespec* ts, unsigned long usec);
+
+#endif
@@ -2,6 +2,12 @@
 #define MICTCP_CORE_H
 
 #include <mictcp.h>
+#include <api/mictcp_wire.h>
+#include <api/mictcp_crc32c.h>
+#include <api/mictcp_clock.h>
+#include <api/mictcp_impair.h>
+#include <api/mictcp_sim.h>
+#include <api/mictcp_trace.h>
 #include <math.h>
 
 /**************************************************************
@@ -9,15 +15,36 @@
  **************************************************************/
 
 int initialize_components(start_mode sm);
+void set_thread_side(start_mode sm);
 
 int IP_send(mic_tcp_pdu, mic_tcp_sock_addr);
 int IP_recv(mic_tcp_pdu*, mic_tcp_sock_addr*, unsigned long timeout);
-int app_buffer_get(mic_tcp_payload);
-void app_buffer_put(mic_tcp_payload);
+int app_buffer_get(int socket, mic_tcp_payload);
+int app_buffer_get_stamped(int socket, mic_tcp_payload, unsigned long* stamp);
+int app_buffer_get_stream(int socket, mic_tcp_payload, unsigned long* stamp, int* stream);
+int app_buffer_get_many(int socket, mic_tcp_payload* app_buffs, unsigned long* stamps, int count);
+int app_buffer_get_loan(int socket, mic_tcp_payload* app_buff, unsigned long* stamp, int* stream, void** packet);
+void app_buffer_release(void* packet);
+void app_buffer_put(int socket, mic_tcp_payload);
+void app_buffer_put_stream(int socket, mic_tcp_payload, int stream);
+void app_buffer_clear(int socket);
+int app_buffer_count(int socket);
+
+void wait_event(int (*)(void*), void*);
+void signal_event(void);
 
 void set_loss_rate(unsigned short);
+void set_impairment(const mictcp_impair*);
+void get_impairment(mictcp_impair*);
+unsigned short get_loss_rate(void);
+void set_checksum(int);
+void set_busy_poll(unsigned long usec);
+int set_listener_cpu(int cpu);
+int set_socket_buffers(unsigned long bytes);
+void sleep_usec(unsigned long usec);
 unsigned long get_now_time_msec();
 unsigned long get_now_time_usec();
+unsigned long get_coarse_time_usec();
 
 /**********************************************************************
  * Private core functions, should not be used for implementing mictcp *
@@ -28,7 +55,9 @@ unsigned long get_now_time_usec();
 #ifndef API_SC_Port
   #define API_SC_Port 8525
 #endif
-#define API_HD_Size 15
+#define API_HD_Size MICTCP_WIRE_HEADER_SIZE
+#define API_CRC_Size 8 /* CRC32C option with its padding */
+#define API_MAX_DATAGRAM 65536
 
 typedef struct ip_payload
 {
@@ -38,9 +67,11 @@ typedef struct ip_payload
 
 int mic_tcp_core_send(mic_tcp_payload);
 mic_tcp_payload get_full_stream(mic_tcp_pdu);
+int check_stream(char*, int, int);
 mic_tcp_payload get_mic_tcp_data(ip_payload);
 mic_tcp_header get_mic_tcp_header(ip_payload);
 void* listening(void*);
+int app_buffer_ready(void* socket);
 void print_header(mic_tcp_pdu);
 
 int min_size(int, int);
@@ -0,0 +1,27 @@
+#ifndef MICTCP_CRC32C_H
+#define MICTCP_CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli) of size bytes at data, continuing from crc
+ * (use 0 for a fresh checksum). The implementation is picked at runtime:
+ * carry-less multiply folding over 64-byte blocks with AVX-512 VPCLMULQDQ,
+ * SSE4.2 crc32 instructions, or slice-by-8 tables, whichever the CPU allows.
+ */
+uint32_t mictcp_crc32c(uint32_t crc, const void* data, size_t size);
+
+/*
+ * Copies size bytes from src to dst and returns their CRC-32C like
+ * mictcp_crc32c(). With VPCLMULQDQ the data is read once for both.
+ */
+uint32_t mictcp_crc32c_copy(uint32_t crc, void* dst, const void* src, size_t size);
+
+/* Portable slice-by-8 implementation, exposed for benchmarking */
+uint32_t mictcp_crc32c_sw(uint32_t crc, const void* data, size_t size);
+
+/* Name of the implementation used by mictcp_crc32c() */
+const char* mictcp_crc32c_impl(void);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef MICTCP_HIST_H
+#define MICTCP_HIST_H
+
+#include <stdio.h>
+
+/*****************************************************************
+ * Log-linear latency histograms (HDR style)                     *
+ *                                                               *
+ * Values (microseconds) below 2^SUB_BITS are counted exactly;   *
+ * above, each power of two is split into 2^(SUB_BITS-1) linear  *
+ * buckets, so any value is known within 1/64 (< 1.6 %). Memory  *
+ * is fixed, recording is a single relaxed atomic increment      *
+ * (wait-free) and histograms can be merged bucket by bucket.    *
+ *****************************************************************/
+
+#define MICTCP_HIST_SUB_BITS 7
+#define MICTCP_HIST_MAX_BITS 32    /* values are clamped below 2^32 us (71 min) */
+#define MICTCP_HIST_HALF (1 << (MICTCP_HIST_SUB_BITS - 1))
+#define MICTCP_HIST_BUCKETS ((MICTCP_HIST_MAX_BITS - MICTCP_HIST_SUB_BITS + 2) * MICTCP_HIST_HALF)
+
+typedef struct mictcp_hist
+{
+    unsigned long total;    /* number of recorded values */
+    unsigned long sum;      /* sum of the recorded values, for the mean */
+    unsigned long counts[MICTCP_HIST_BUCKETS];
+} mictcp_hist;
+
+/* Wait-free, callable concurrently with every other function */
+void mictcp_hist_record(mictcp_hist* hist, unsigned long value);
+
+void mictcp_hist_reset(mictcp_hist* hist);
+
+/* Adds src to dst; with dst == a zeroed histogram, takes a snapshot */
+void mictcp_hist_merge(mictcp_hist* dst, const mictcp_hist* src);
+
+/* Value at or below which a fraction p (0..1) of the records lie,
+   rounded up to the top of its bucket; 0 for an empty histogram */
+unsigned long mictcp_hist_percentile(const mictcp_hist* hist, double p);
+unsigned long mictcp_hist_mean(const mictcp_hist* hist);
+
+/* CSV export: one "low_us,high_us,count" line per non-empty bucket */
+void mictcp_hist_export(const mictcp_hist* hist, FILE* out);
+
+#endif
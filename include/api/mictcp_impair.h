@@ -0,0 +1,86 @@
+#ifndef MICTCP_IMPAIR_H
+#define MICTCP_IMPAIR_H
+
+#include <stdint.h>
+
+/*****************************************************************
+ * Network impairment model                                      *
+ *                                                               *
+ * Decides the fate of each sent packet, like Linux netem: loss  *
+ * (independent or in bursts with a Gilbert-Elliott two-state    *
+ * channel), added delay and jitter, duplication and reordering. *
+ * Used by the core on the UDP path and by the simulated links.  *
+ *****************************************************************/
+
+/* xoshiro256** generator */
+typedef struct mictcp_rng
+{
+    uint64_t s[4];
+} mictcp_rng;
+
+void mictcp_rng_seed(mictcp_rng* rng, uint64_t seed);
+
+static inline uint64_t mictcp_rng_next(mictcp_rng* rng)
+{
+    uint64_t* s = rng->s;
+    const uint64_t x = s[1] * 5;
+    const uint64_t result = ((x << 7) | (x >> 57)) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+    return result;
+}
+
+/* Uniform in [0, 1) */
+static inline double mictcp_rng_uniform(mictcp_rng* rng)
+{
+    return (double)(mictcp_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Impairments of one direction. Probabilities are in [0, 1].
+ */
+typedef struct mictcp_impair
+{
+    double loss;                /* loss probability in the good state */
+    double burst_enter;         /* probability to enter the bad (burst) state */
+    double burst_exit;          /* probability to leave the bad state */
+    double burst_loss;          /* loss probability in the bad state */
+    unsigned long delay;        /* added delay (us) */
+    unsigned long jitter;       /* uniform random extra delay in [0, jitter] (us) */
+    double duplicate;           /* probability to deliver a packet twice */
+    double reorder;             /* probability for a packet to skip the delay */
+} mictcp_impair;
+
+/* Maximum number of copies of a packet */
+#define MICTCP_IMPAIR_COPIES 2
+
+/*
+ * Draws the fate of one packet. bad is the state of the Gilbert-Elliott
+ * channel, kept by the caller. Returns the number of copies to deliver
+ * (0 when the packet is lost) and the delay of each one in delays (us).
+ */
+int mictcp_impair_apply(const mictcp_impair* impair, int* bad, mictcp_rng* rng,
+                        unsigned long delays[MICTCP_IMPAIR_COPIES]);
+
+/* Whether some packets may be delayed, and so need a delay line */
+int mictcp_impair_delays(const mictcp_impair* impair);
+
+/*
+ * Parses a comma-separated description, as in the MICTCP_IMPAIR
+ * environment variable, on top of the current values of impair:
+ *   loss=P            independent loss
+ *   burst=E:X[:L]     Gilbert-Elliott enter/exit probabilities, loss when bad (default 100)
+ *   delay=T jitter=T  times in ms, fractional values allowed
+ *   dup=P reorder=P
+ * Probabilities are percentages (fractional values allowed, optional %).
+ * Returns 0, or -1 if the description is invalid.
+ */
+int mictcp_impair_parse(const char* spec, mictcp_impair* impair);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MICTCP_LOG_H
+#define MICTCP_LOG_H
+
+#include <stdio.h>
+
+/*****************************************************************
+ * Asynchronous logger                                           *
+ *                                                               *
+ * MICTCP_LOG() formats the message into a slot of a lock-free   *
+ * queue; a background thread writes the queue out every        *
+ * MICTCP_LOG_PERIOD ms, or earlier when it fills up. Messages   *
+ * above the runtime level cost one comparison, and each call    *
+ * site is limited to MICTCP_LOG_RATE messages per second: the   *
+ * excess is counted and reported instead of being written.      *
+ *****************************************************************/
+
+#define MICTCP_LOG_ERROR 0
+#define MICTCP_LOG_WARN 1
+#define MICTCP_LOG_INFO 2
+#define MICTCP_LOG_DEBUG 3
+
+#define MICTCP_LOG_QUEUE 1024   /* slots, power of two */
+#define MICTCP_LOG_LINE 240     /* longest message */
+#define MICTCP_LOG_PERIOD 10    /* ms between two polls of the writer */
+#ifndef MICTCP_LOG_RATE
+  #define MICTCP_LOG_RATE 20    /* messages per second and call site */
+#endif
+
+/* Rate limiting state of one call site */
+typedef struct mictcp_log_site
+{
+    unsigned long window;       /* current second */
+    unsigned long count;        /* messages in the current second */
+    unsigned long suppressed;   /* messages dropped since the last report */
+} mictcp_log_site;
+
+extern int mictcp_log_level;
+
+void mictcp_log_write(mictcp_log_site* site, int level, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define MICTCP_LOG(level, ...) \
+    do { \
+        if ((level) <= mictcp_log_level) { \
+            static mictcp_log_site mictcp_log_site_; \
+            mictcp_log_write(&mictcp_log_site_, (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+void mictcp_log_set_level(int level);
+
+/* Parses "error", "warn", "info", "debug" or a number; -1 if invalid */
+int mictcp_log_parse_level(const char* name);
+
+/* Destination of the messages (stderr by default) */
+void mictcp_log_set_output(FILE* output);
+
+/* Writes every queued message before returning */
+void mictcp_log_flush(void);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef MICTCP_LZ4_H
+#define MICTCP_LZ4_H
+
+/*****************************************************************
+ * LZ4 block compression                                         *
+ *                                                               *
+ * A small single-pass LZ4 block codec (greedy parser, 4 KB hash *
+ * table on the stack), compatible with the reference block      *
+ * format. Blocks are limited to 64 KB, which covers any PDU.    *
+ *****************************************************************/
+
+#define MICTCP_LZ4_MAX_BLOCK 65535
+
+/*
+ * Compresses size bytes of src into at most capacity bytes of dst.
+ * Returns the compressed size, or 0 when the result does not fit
+ * (so a capacity below size rejects data that does not shrink).
+ */
+int mictcp_lz4_compress(const void* src, int size, void* dst, int capacity);
+
+/* Decompresses a block. Returns the original size, or -1 if the block is malformed
+   or would not fit in capacity bytes */
+int mictcp_lz4_decompress(const void* src, int size, void* dst, int capacity);
+
+/*
+ * Order-0 entropy of up to 256 bytes sampled across data, relative to
+ * the highest entropy the sample can show: above 0.85 for already
+ * compressed data (video, archives), around 0.55 for text.
+ */
+double mictcp_lz4_entropy(const void* data, int size);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef MICTCP_SIM_H
+#define MICTCP_SIM_H
+
+/*****************************************************************
+ * In-process network simulator                                  *
+ *                                                               *
+ * Replaces the UDP fake IP with two in-memory links (client to  *
+ * server and server to client) and a virtual clock. Time only   *
+ * moves forward when every thread taking part in the exchange   *
+ * (the actors) is blocked in the simulator; it then jumps to    *
+ * the next packet delivery or timeout. A whole exchange runs    *
+ * in one process, as fast as the CPU allows, and is             *
+ * reproducible for a given seed.                                *
+ *****************************************************************/
+
+#include <api/mictcp_impair.h>
+
+/*
+ * One direction of the simulated network
+ */
+typedef struct mictcp_sim_link
+{
+    mictcp_impair impair;       /* loss, propagation delay, jitter... */
+    unsigned long bandwidth;    /* serialization rate (bytes/s), 0 for unlimited */
+    unsigned long queue;        /* bytes waiting for serialization before drop-tail,
+                                   0 for unlimited */
+} mictcp_sim_link;
+
+typedef struct mictcp_sim_config
+{
+    unsigned long long seed;
+    mictcp_sim_link link[2];    /* indexed by the sending side (CLIENT, SERVER) */
+} mictcp_sim_config;
+
+/* Counters of one link */
+typedef struct mictcp_sim_stats
+{
+    unsigned long sent;
+    unsigned long dropped;
+    unsigned long delivered;
+} mictcp_sim_stats;
+
+/* Switch the core to the simulator, before any socket is created */
+void mictcp_sim_enable(const mictcp_sim_config* config);
+int mictcp_sim_enabled(void);
+
+/* Virtual time since mictcp_sim_enable() */
+unsigned long mictcp_sim_now_usec(void);
+
+/*
+ * Actors: reserve a slot before creating a thread that will use the
+ * stack, then call mictcp_sim_attach() first thing in that thread. Threads
+ * calling the simulator without a reservation are attached on the fly.
+ * A thread leaves the simulation when it exits or calls mictcp_sim_detach().
+ */
+void mictcp_sim_reserve(void);
+void mictcp_sim_attach(void);
+void mictcp_sim_detach(void);
+
+/* Block a non-actor thread until the simulation cannot make progress anymore */
+void mictcp_sim_wait_idle(void);
+
+/* Fake IP */
+int mictcp_sim_send(int side, const char* data, int size);
+int mictcp_sim_recv(int side, char* buffer, int size, unsigned long timeout);
+
+/* Virtual-time waits for the rest of the core */
+void mictcp_sim_wait(int (*ready)(void*), void* arg);
+void mictcp_sim_notify(void);
+void mictcp_sim_sleep_usec(unsigned long usec);
+
+void mictcp_sim_get_stats(int side, mictcp_sim_stats* stats);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef MICTCP_SIPHASH_H
+#define MICTCP_SIPHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * SipHash-2-4 of size bytes at data under a 128-bit key: a fast keyed
+ * hash, used as a short message authentication code.
+ */
+uint64_t mictcp_siphash(const unsigned char key[16], const void* data, size_t size);
+
+#endif
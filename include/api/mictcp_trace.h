@@ -0,0 +1,87 @@
+#ifndef MICTCP_TRACE_H
+#define MICTCP_TRACE_H
+
+#include <stdint.h>
+#include <mictcp.h>
+
+/*****************************************************************
+ * Binary event trace                                            *
+ *                                                               *
+ * Each thread records fixed-size events in its own ring,        *
+ * without locks or system calls. Old events are overwritten.    *
+ * Each event is stamped with the last time its thread read from *
+ * the protocol clock, published by mictcp_trace_time(): the     *
+ * stack reads it once per datagram received and around each     *
+ * send anyway, so recording costs a thread-local load rather    *
+ * than a clock read. The rings are merged in time order and     *
+ * written as pcapng on demand (mictcp_trace_dump) or when a     *
+ * signal arrives, one packet per event on the LINKTYPE_USER0    *
+ * link type. In Wireshark, decode DLT 147 with a dissector for  *
+ * mictcp_trace_event (all fields in little endian).             *
+ *****************************************************************/
+
+#define MICTCP_TRACE_RING 4096      /* events per thread, power of two */
+#define MICTCP_TRACE_THREADS 64
+#define MICTCP_TRACE_LINKTYPE 147   /* LINKTYPE_USER0 */
+#define MICTCP_TRACE_NO_SOCKET 0xff
+
+typedef enum mictcp_trace_type
+{
+    TRACE_TX = 1,       /* PDU handed to the fake IP (size = payload) */
+    TRACE_RX,           /* PDU received from the fake IP */
+    TRACE_DROP,         /* PDU dropped by the impairment model */
+    TRACE_TIMER,        /* receive timeout fired (arg = timeout in ms) */
+    TRACE_ACK,          /* expected ACK received (arg = RTT in us) */
+    TRACE_LOSS,         /* loss detected (arg = 1 if ignored) */
+    TRACE_RETRANSMIT,   /* data PDU sent again */
+    TRACE_STATE         /* state change (arg = new protocol_state) */
+} mictcp_trace_type;
+
+/* One event, 32 bytes */
+typedef struct mictcp_trace_event
+{
+    uint64_t usec;      /* protocol clock (virtual time in simulation) */
+    uint8_t type;       /* mictcp_trace_type */
+    uint8_t socket;     /* MIC-TCP descriptor, or MICTCP_TRACE_NO_SOCKET */
+    uint8_t flags;      /* SYN 0x01, ACK 0x02, FIN 0x04, MORE 0x08, BATCH 0x10, LZ4 0x20 */
+    uint8_t stream;     /* stream of the connection */
+    uint32_t thread;    /* index of the recording thread, set in exports */
+    uint32_t seq;
+    uint32_t ack;
+    uint32_t size;
+    uint32_t arg;
+} mictcp_trace_event;
+
+extern int mictcp_trace_enabled;
+extern __thread unsigned long mictcp_trace_clock;
+
+/* Publishes a time the calling thread just read from the protocol clock,
+   for its next events */
+static inline void mictcp_trace_time(unsigned long usec)
+{
+    mictcp_trace_clock = usec;
+}
+
+/* Protocol clock the stamps come from (mictcp_clock_usec by default): read
+   by threads that have not published a time yet, and when dumping to place
+   the events in wall-clock time */
+void mictcp_trace_set_clock(unsigned long (*now)(void));
+
+void mictcp_trace_record(int type, int socket, const mic_tcp_header* header, int size, unsigned int arg);
+
+/* Cheap when tracing is off: one predictable branch */
+#define MICTCP_TRACE(type, socket, header, size, arg) \
+    do { \
+        if (__builtin_expect(mictcp_trace_enabled, 0)) \
+            mictcp_trace_record((type), (socket), (header), (size), (arg)); \
+    } while (0)
+
+void mictcp_trace_enable(int enabled);
+
+/* Writes every ring to a pcapng file. Returns the number of events, or -1 */
+int mictcp_trace_dump(const char* path);
+
+/* Dumps to path each time signum is received (from a helper thread) */
+int mictcp_trace_dump_on_signal(int signum, const char* path);
+
+#endif
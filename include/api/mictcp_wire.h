@@ -0,0 +1,150 @@
+#ifndef MICTCP_WIRE_H
+#define MICTCP_WIRE_H
+
+#include <mictcp.h>
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/*****************************************************************
+ * MICTCP wire format                                            *
+ *                                                               *
+ *  0               1               2               3            *
+ * +---------------+---------------+---------------+-----------+ *
+ * |    version    |     flags     |     hlen      |  stream   | *
+ * +---------------+---------------+---------------+-----------+ *
+ * |          source port          |       destination port    | *
+ * +-------------------------------+---------------------------+ *
+ * |                       sequence number                     | *
+ * +-----------------------------------------------------------+ *
+ * |                    acknowledgment number                  | *
+ * +-------------------------------+---------------------------+ *
+ * |            window             |          reserved         | *
+ * +-------------------------------+---------------------------+ *
+ * |             options (TLV, padded to 32 bits)              | *
+ * +-----------------------------------------------------------+ *
+ *                                                               *
+ * Every multi-byte field is in network byte order. hlen is the  *
+ * full header length (options included) in 32-bit words.        *
+ * stream selects one of the independent ordered streams of the  *
+ * connection, each with its own sequence space.                 *
+ *****************************************************************/
+
+#define MICTCP_WIRE_VERSION 1
+#define MICTCP_WIRE_HEADER_SIZE 20
+#define MICTCP_WIRE_HEADER_MAX 60
+
+/* Flags byte */
+#define MICTCP_FLAG_SYN 0x01
+#define MICTCP_FLAG_ACK 0x02
+#define MICTCP_FLAG_FIN 0x04
+#define MICTCP_FLAG_MORE 0x08   /* more segments of the same message follow */
+#define MICTCP_FLAG_BATCH 0x10  /* payload packs several messages, each prefixed by its 16-bit length */
+#define MICTCP_FLAG_LZ4 0x20    /* payload is an LZ4 block */
+
+/* Option types, encoded as { type, length, value... } where length counts
+   the type and length bytes. END and NOP are single bytes. */
+#define MICTCP_OPT_END 0
+#define MICTCP_OPT_NOP 1
+#define MICTCP_OPT_CRC32C 2 /* 4 bytes, CRC-32C of the whole packet with this field zeroed */
+
+/* Field offsets */
+#define MICTCP_WIRE_OFF_VERSION 0
+#define MICTCP_WIRE_OFF_FLAGS 1
+#define MICTCP_WIRE_OFF_HLEN 2
+#define MICTCP_WIRE_OFF_STREAM 3
+#define MICTCP_WIRE_OFF_SPORT 4
+#define MICTCP_WIRE_OFF_DPORT 6
+#define MICTCP_WIRE_OFF_SEQ 8
+#define MICTCP_WIRE_OFF_ACK 12
+#define MICTCP_WIRE_OFF_WINDOW 16
+
+static inline void wire_put16(unsigned char* p, uint16_t v) { v = htons(v); memcpy(p, &v, 2); }
+static inline void wire_put32(unsigned char* p, uint32_t v) { v = htonl(v); memcpy(p, &v, 4); }
+static inline uint16_t wire_get16(const unsigned char* p) { uint16_t v; memcpy(&v, p, 2); return ntohs(v); }
+static inline uint32_t wire_get32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return ntohl(v); }
+
+/*
+ * Write the fixed part of the header at the start of buf, announcing a
+ * header of hlen bytes (a multiple of 4, options included).
+ * buf must hold at least MICTCP_WIRE_HEADER_SIZE bytes.
+ */
+static inline void mictcp_wire_encode(const mic_tcp_header* hd, unsigned char* buf, int hlen)
+{
+    buf[MICTCP_WIRE_OFF_VERSION] = MICTCP_WIRE_VERSION;
+    buf[MICTCP_WIRE_OFF_FLAGS] = (unsigned char)(((hd->syn != 0) * MICTCP_FLAG_SYN)
+                                               | ((hd->ack != 0) * MICTCP_FLAG_ACK)
+                                               | ((hd->fin != 0) * MICTCP_FLAG_FIN)
+                                               | ((hd->more != 0) * MICTCP_FLAG_MORE)
+                                               | ((hd->batch != 0) * MICTCP_FLAG_BATCH)
+                                               | ((hd->compressed != 0) * MICTCP_FLAG_LZ4));
+    buf[MICTCP_WIRE_OFF_HLEN] = (unsigned char)(hlen >> 2);
+    buf[MICTCP_WIRE_OFF_STREAM] = hd->stream;
+    wire_put16(buf + MICTCP_WIRE_OFF_SPORT, hd->source_port);
+    wire_put16(buf + MICTCP_WIRE_OFF_DPORT, hd->dest_port);
+    wire_put32(buf + MICTCP_WIRE_OFF_SEQ, hd->seq_num);
+    wire_put32(buf + MICTCP_WIRE_OFF_ACK, hd->ack_num);
+    wire_put16(buf + MICTCP_WIRE_OFF_WINDOW, hd->window);
+    wire_put16(buf + 18, 0);
+}
+
+/*
+ * Read the fixed part of the header of a received packet of size bytes.
+ * buf must hold at least MICTCP_WIRE_HEADER_SIZE readable bytes, even when
+ * size is smaller: validation is folded in after the loads.
+ * Return the full header length in bytes, or -1 if the packet is malformed.
+ */
+static inline int mictcp_wire_decode(const unsigned char* buf, int size, mic_tcp_header* hd)
+{
+    const unsigned int flags = buf[MICTCP_WIRE_OFF_FLAGS];
+    const int hlen = buf[MICTCP_WIRE_OFF_HLEN] << 2;
+    const int valid = (buf[MICTCP_WIRE_OFF_VERSION] == MICTCP_WIRE_VERSION)
+                    & (hlen >= MICTCP_WIRE_HEADER_SIZE)
+                    & (hlen <= size);
+
+    hd->source_port = wire_get16(buf + MICTCP_WIRE_OFF_SPORT);
+    hd->dest_port = wire_get16(buf + MICTCP_WIRE_OFF_DPORT);
+    hd->seq_num = wire_get32(buf + MICTCP_WIRE_OFF_SEQ);
+    hd->ack_num = wire_get32(buf + MICTCP_WIRE_OFF_ACK);
+    hd->syn = flags & MICTCP_FLAG_SYN;
+    hd->ack = (flags & MICTCP_FLAG_ACK) >> 1;
+    hd->fin = (flags & MICTCP_FLAG_FIN) >> 2;
+    hd->more = (flags & MICTCP_FLAG_MORE) >> 3;
+    hd->batch = (flags & MICTCP_FLAG_BATCH) >> 4;
+    hd->compressed = (flags & MICTCP_FLAG_LZ4) >> 5;
+    hd->window = wire_get16(buf + MICTCP_WIRE_OFF_WINDOW);
+    hd->stream = buf[MICTCP_WIRE_OFF_STREAM];
+
+    /* hlen when valid, -1 otherwise */
+    return (hlen & -valid) | (valid - 1);
+}
+
+/*
+ * Append option { type, len, value } at offset off of a header being built.
+ * Return the new offset.
+ */
+static inline int mictcp_wire_put_option(unsigned char* buf, int off, unsigned char type, const void* value, unsigned char value_size)
+{
+    buf[off] = type;
+    buf[off + 1] = value_size + 2;
+    memcpy(buf + off + 2, value, value_size);
+    return off + value_size + 2;
+}
+
+/*
+ * Pad the options area with NOPs so that the header ends on a 32-bit boundary.
+ * Return the final header length.
+ */
+static inline int mictcp_wire_pad(unsigned char* buf, int off)
+{
+    while (off & 3) buf[off++] = MICTCP_OPT_NOP;
+    return off;
+}
+
+/*
+ * Look up option type in a decoded header of hlen bytes.
+ * Return a pointer to its value (and its size in *value_size), or NULL.
+ */
+const unsigned char* mictcp_wire_get_option(const unsigned char* buf, int hlen, unsigned char type, int* value_size);
+
+#endif
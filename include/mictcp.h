@@ -13,6 +13,8 @@
 #include <netdb.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <api/mictcp_hist.h>
+#include <api/mictcp_log.h>
 
 #ifndef MICTCP_LOSS_RATE
   #define MICTCP_LOSS_RATE 1
@@ -20,9 +22,15 @@
 
 // CONFIGURATION
 
-// Nombre de sockets pouvant être gérés simultanément.
+// Nombre de sockets pouvant être gérés simultanément (connexions en attente d'un socket
+// d'écoute comprises).
 #ifndef MICTCP_SOCKETS
-  #define MICTCP_SOCKETS 8
+  #define MICTCP_SOCKETS 32
+#endif
+// Nombre de flux indépendants par connexion (256 au plus), chacun avec ses
+// numéros de séquence et sa fiabilité partielle.
+#ifndef MICTCP_STREAMS
+  #define MICTCP_STREAMS 4
 #endif
 // Numéro de séquence initiale.
 #ifndef MICTCP_INITIAL_SEQ
@@ -52,10 +60,93 @@
 #ifndef MICTCP_RELIABILITY_DEFAULT
   #define MICTCP_RELIABILITY_DEFAULT 100 // %
 #endif
+// Ajout d'une somme de contrôle CRC32C à chaque PDU (0 ou 1).
+#ifndef MICTCP_CHECKSUM
+  #define MICTCP_CHECKSUM 0
+#endif
+// Taille maximale des données d'un PDU, négociée à la connexion : un message
+// plus grand est découpé en segments et réassemblé avant d'être remis.
+#ifndef MICTCP_MSS
+  #define MICTCP_MSS 1400 // octets
+#endif
+// Messages lus au plus par un appel de mic_tcp_recv_many.
+#ifndef MICTCP_RECV_MANY_MAX
+  #define MICTCP_RECV_MANY_MAX 64
+#endif
+// Taille maximale d'un message réassemblé.
+#ifndef MICTCP_MESSAGE_MAX
+  #define MICTCP_MESSAGE_MAX (1 << 20) // octets
+#endif
+// Regroupement des petits messages d'un flux dans un même PDU (0 ou 1).
+#ifndef MICTCP_CORK
+  #define MICTCP_CORK 0
+#endif
+// Délai maximal avant l'envoi d'un regroupement incomplet.
+#ifndef MICTCP_CORK_DELAY
+  #define MICTCP_CORK_DELAY 5 // ms
+#endif
+// Compression LZ4 des charges utiles, si les deux extrémités l'acceptent (0 ou 1).
+#ifndef MICTCP_COMPRESS
+  #define MICTCP_COMPRESS 0
+#endif
+// Taille minimale d'une charge utile à compresser.
+#ifndef MICTCP_COMPRESS_MIN
+  #define MICTCP_COMPRESS_MIN 64 // octets
+#endif
+// Entropie relative au-delà de laquelle une charge utile n'est pas compressée (vidéo, etc.).
+#ifndef MICTCP_COMPRESS_ENTROPY
+  #define MICTCP_COMPRESS_ENTROPY 0.8
+#endif
+// Reprise de connexion sans poignée de main (0-RTT) : le serveur délivre un jeton
+// que le client présente dans son premier PDU de données à la connexion suivante (0 ou 1).
+#ifndef MICTCP_RESUME
+  #define MICTCP_RESUME 0
+#endif
+// Durée de validité d'un jeton de reprise.
+#ifndef MICTCP_RESUME_LIFETIME
+  #define MICTCP_RESUME_LIFETIME 300 // s
+#endif
+// Nombre de jetons de reprise gardés par le client (un par serveur).
+#ifndef MICTCP_RESUME_CACHE
+  #define MICTCP_RESUME_CACHE 16
+#endif
+// Durée pendant laquelle un socket serveur fermé acquitte encore les renvois de son ancien
+// client (TIME_WAIT), avant que son descripteur ne soit réutilisé.
+#ifndef MICTCP_TIME_WAIT
+  #define MICTCP_TIME_WAIT 500 // ms
+#endif
+// Connexions en cours d'établissement ou établies qu'un socket d'écoute garde en attente de
+// mic_tcp_accept (moins de MICTCP_SOCKETS). Au-delà, il répond aux SYN par des SYN cookies.
+#ifndef MICTCP_BACKLOG
+  #define MICTCP_BACKLOG 8
+#endif
+// Débit d'émission lissé par un seau à jetons (0 : PDU émis sans attente).
+#ifndef MICTCP_PACING_RATE
+  #define MICTCP_PACING_RATE 0 // octets/s
+#endif
+// Profondeur du seau : octets émis d'affilée après une pause, en-têtes compris.
+#ifndef MICTCP_PACING_BURST
+  #define MICTCP_PACING_BURST (2 * MICTCP_MSS) // octets
+#endif
 // Tentatives de connexion maximales.
 #ifndef MICTCP_RETRIES
   #define MICTCP_RETRIES 3 // %
 #endif
+// Délai d'attente d'ACK adaptatif, calculé depuis le RTT mesuré (0 ou 1).
+#ifndef MICTCP_RTO
+  #define MICTCP_RTO 0
+#endif
+// Bornes du délai d'attente d'ACK adaptatif.
+#ifndef MICTCP_RTO_MIN
+  #define MICTCP_RTO_MIN 5 // ms
+#endif
+#ifndef MICTCP_RTO_MAX
+  #define MICTCP_RTO_MAX 1000 // ms
+#endif
+
+// Chacune de ces valeurs peut aussi être modifiée sans recompiler : par une
+// variable d'environnement du même nom (valeur par défaut des nouveaux sockets),
+// ou par socket avec mic_tcp_setsockopt().
 
 // DEBUG
 
@@ -88,7 +179,7 @@
 #endif
 
 #ifdef MICTCP_DEBUG_FUNCTIONS
-  #define MICTCP_DEBUG_FUNCTION printf("[MIC-TCP] Appel de la fonction: "); printf(__FUNCTION__); printf("\n")
+  #define MICTCP_DEBUG_FUNCTION MICTCP_LOG(MICTCP_LOG_DEBUG, "[MIC-TCP] Appel de la fonction: %s", __FUNCTION__)
 #else
   #define MICTCP_DEBUG_FUNCTION
 #endif
@@ -99,7 +190,10 @@
  */
 typedef enum protocol_state
 {
-    IDLE, CLOSED, SYN_SENT, SYN_RECEIVED, ESTABLISHED, CLOSING
+    IDLE, CLOSED, SYN_SENT, SYN_RECEIVED, ESTABLISHED, CLOSING,
+    CLOSE_WAIT,     /* l'autre extrémité a fermé la connexion */
+    TIME_WAIT,      /* fermé, les renvois de l'ancien client sont encore acquittés */
+    LISTEN          /* socket d'écoute, ses connexions ont chacune leur socket */
 } protocol_state;
 
 /*
@@ -137,6 +231,17 @@ typedef struct mic_tcp_payload
   int size; /* taille des données */
 } mic_tcp_payload;
 
+/*
+ * Donnée reçue prêtée par mic_tcp_recv_zc, sans copie, jusqu'à mic_tcp_release
+ */
+typedef struct mic_tcp_loan
+{
+  char* data; /* données applicatives, dans le tampon de réception */
+  int size; /* taille des données */
+  int stream; /* flux de la donnée */
+  void* packet; /* tampon de réception prêté (usage interne) */
+} mic_tcp_loan;
+
 /*
  * Structure de l'entête d'un PDU MIC-TCP
  */
@@ -149,6 +254,11 @@ typedef struct mic_tcp_header
   unsigned char syn; /* flag SYN (valeur 1 si activé et 0 si non) */
   unsigned char ack; /* flag ACK (valeur 1 si activé et 0 si non) */
   unsigned char fin; /* flag FIN (valeur 1 si activé et 0 si non) */
+  unsigned char more; /* d'autres segments du même message suivent (1) ou non (0) */
+  unsigned char batch; /* la charge utile regroupe plusieurs messages préfixés par leur taille (1) ou non (0) */
+  unsigned char compressed; /* la charge utile est compressée en LZ4 (1) ou non (0) */
+  unsigned short window; /* fenêtre annoncée (en paquets) */
+  unsigned char stream; /* flux de la connexion */
 } mic_tcp_header;
 
 /*
@@ -160,6 +270,66 @@ typedef struct mic_tcp_pdu
   mic_tcp_payload payload; /* charge utile du PDU */
 } mic_tcp_pdu;
 
+/*
+ * Statistiques d'un socket (voir mic_tcp_getstats)
+ */
+typedef struct mic_tcp_stats
+{
+  unsigned long bytes_sent; /* octets de données émis (renvois compris) */
+  unsigned long bytes_received; /* octets de données remis au buffer de réception */
+  unsigned long pdus_sent; /* PDU émis (SYN, données, ACK) */
+  unsigned long pdus_received; /* PDU reçus */
+  unsigned long losses; /* pertes détectées (ACK non reçu à temps) */
+  unsigned long retransmits; /* PDU de données renvoyés */
+  unsigned long losses_ignored; /* pertes admises par la fiabilité partielle */
+  unsigned long duplicates; /* PDU de données reçus en double */
+  unsigned long batched; /* messages envoyés regroupés avec d'autres (OPT_CORK) */
+  unsigned long bytes_saved; /* octets de données économisés par la compression (OPT_COMPRESS) */
+  unsigned long rtt_min; /* RTT minimal (µs), 0 si aucune mesure */
+  unsigned long rtt_avg; /* RTT lissé (µs) */
+  unsigned long rtt_var; /* variation lissée du RTT (µs) */
+  unsigned long window; /* fenêtre de détection de perte (paquets) */
+  unsigned long queue; /* messages en attente dans le buffer de réception */
+  unsigned long pacing_delay; /* attente imposée par le lissage de l'émission (µs) */
+} mic_tcp_stats;
+
+/*
+ * Options de socket (voir mic_tcp_setsockopt)
+ */
+typedef enum mic_tcp_option
+{
+    OPT_TIMEOUT_ACK,        /* délai d'attente d'un ACK (ms) */
+    OPT_TIMEOUT_CONNECT,    /* délai d'attente d'un SYN ACK (ms) */
+    OPT_WINDOW,             /* fenêtre de détection de perte (paquets) */
+    OPT_RELIABILITY,        /* fiabilité partielle proposée (%) */
+    OPT_RETRIES,            /* tentatives de connexion */
+    OPT_RTO,                /* délai d'attente d'ACK adaptatif (0 ou 1) */
+    OPT_RTO_MIN,            /* borne basse du délai adaptatif (ms) */
+    OPT_RTO_MAX,            /* borne haute du délai adaptatif (ms) */
+    OPT_MSS,                /* taille maximale des données d'un PDU (octets) */
+    OPT_CORK,               /* regroupement des petits messages (0 ou 1) */
+    OPT_CORK_DELAY,         /* délai maximal d'un regroupement incomplet (ms) */
+    OPT_COMPRESS,           /* compression LZ4 des charges utiles (0 ou 1) */
+    OPT_RESUME,             /* reprise de connexion sans poignée de main (0 ou 1) */
+    OPT_TIME_WAIT,          /* durée de l'état TIME_WAIT d'un socket serveur fermé (ms) */
+    OPT_BACKLOG,            /* connexions en attente de mic_tcp_accept */
+    OPT_PACING_RATE,        /* débit d'émission lissé (octets/s), 0 sans lissage */
+    OPT_PACING_BURST,       /* profondeur du seau à jetons du lissage (octets) */
+    OPT_LOSS_RATE,          /* pertes de l'IP factice (%), commun au processus */
+    OPTIONS
+} mic_tcp_option;
+
+/*
+ * Latences mesurées par socket (voir mic_tcp_gethist)
+ */
+typedef enum mic_tcp_latency
+{
+    LATENCY_ACK,        /* de l'entrée dans mic_tcp_send au ACK */
+    LATENCY_DELIVERY,   /* de la réception du PDU à sa remise à l'application */
+    LATENCY_CONNECT,    /* durée de la poignée de main dans mic_tcp_connect */
+    LATENCIES
+} mic_tcp_latency;
+
 typedef struct app_buffer
 {
     mic_tcp_payload packet;
@@ -173,11 +343,23 @@ typedef struct app_buffer
  ****************************/
 int mic_tcp_socket(start_mode sm);
 int mic_tcp_bind(int socket, mic_tcp_sock_addr addr);
+int mic_tcp_listen(int socket);
 int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr);
 int mic_tcp_connect(int socket, mic_tcp_sock_addr addr);
 int mic_tcp_send (int socket, char* mesg, int mesg_size);
+int mic_tcp_send_stream(int socket, int stream, char* mesg, int mesg_size);
 int mic_tcp_recv (int socket, char* mesg, int max_mesg_size);
+int mic_tcp_recv_stream(int socket, int* stream, char* mesg, int max_mesg_size);
+int mic_tcp_recv_many(int socket, mic_tcp_payload* mesgs, int count);
+int mic_tcp_recv_zc(int socket, mic_tcp_loan* loan);
+int mic_tcp_release(int socket, mic_tcp_loan* loan);
 void process_received_PDU(mic_tcp_pdu pdu, mic_tcp_sock_addr addr);
+int mic_tcp_flush(int socket);
 int mic_tcp_close(int socket);
+int mic_tcp_getstats(int socket, mic_tcp_stats* stats);
+int mic_tcp_setsockopt(int socket, mic_tcp_option option, int value);
+int mic_tcp_set_stream_reliability(int socket, int stream, int reliability);
+int mic_tcp_getsockopt(int socket, mic_tcp_option option, int* value);
+int mic_tcp_gethist(int socket, mic_tcp_latency latency, mictcp_hist* hist);
 
 #endif
@@ -0,0 +1,103 @@
+#include <api/mictcp_clock.h>
+#include <pthread.h>
+#include <stdint.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#define TSC_SHIFT 42
+
+/*******************
+ * Clock Variables *
+ *******************/
+unsigned long mictcp_clock_coarse = 0;
+
+static int use_tsc = 0;
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static int tsc_ready = 0;
+static double tsc_hz = 0.0;
+
+/* usec = usec_base + (tsc - tsc_base) * tsc_mult >> TSC_SHIFT */
+static uint64_t tsc_base, tsc_mult;
+static unsigned long usec_base;
+
+/*******************
+ * Local functions *
+ *******************/
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__x86_64__)
+static int tsc_invariant(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    /* Fails when the CPU lacks the extended leaf */
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return 0;
+    return (edx >> 8) & 1;
+}
+
+static void calibrate(void)
+{
+    if (!tsc_invariant()) return;
+
+    /* Both clocks are read back to back at each end of the interval */
+    const uint64_t ns0 = monotonic_ns(), tsc0 = __rdtsc();
+    uint64_t ns1, tsc1;
+    do {
+        ns1 = monotonic_ns();
+        tsc1 = __rdtsc();
+    } while (ns1 - ns0 < MICTCP_CLOCK_CALIBRATION * 1000000ULL);
+
+    tsc_mult = (uint64_t)(((unsigned __int128)(ns1 - ns0) << TSC_SHIFT) / ((unsigned __int128)(tsc1 - tsc0) * 1000));
+    tsc_base = tsc1;
+    usec_base = ns1 / 1000;
+    tsc_hz = (double)(tsc1 - tsc0) * 1e9 / (double)(ns1 - ns0);
+    __atomic_store_n(&tsc_ready, 1, __ATOMIC_RELEASE);
+}
+#else
+static void calibrate(void)
+{
+}
+#endif
+
+/********************
+ * Public functions *
+ ********************/
+
+unsigned long mictcp_clock_usec(void)
+{
+#if defined(__x86_64__)
+    if (__atomic_load_n(&use_tsc, __ATOMIC_ACQUIRE)) {
+        return usec_base + (unsigned long)(((unsigned __int128)(__rdtsc() - tsc_base) * tsc_mult) >> TSC_SHIFT);
+    }
+#endif
+    return monotonic_ns() / 1000;
+}
+
+int mictcp_clock_use_tsc(int enabled)
+{
+    if (enabled) {
+        pthread_once(&calibrate_once, calibrate);
+        if (!__atomic_load_n(&tsc_ready, __ATOMIC_ACQUIRE)) return -1;
+    }
+    __atomic_store_n(&use_tsc, enabled != 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+double mictcp_clock_tsc_hz(void)
+{
+    return __atomic_load_n(&tsc_ready, __ATOMIC_ACQUIRE) ? tsc_hz : 0.0;
+}
+
+void mictcp_clock_deadline(struct timespec* ts, unsigned long usec)
+{
+    const uint64_t ns = monotonic_ns() + (uint64_t) usec * 1000;
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
@@ -1,95 +1,372 @@
+#define _GNU_SOURCE     // pthread_setaffinity_np
 #include <api/mictcp_core.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <sys/queue.h>
 #include <math.h>
 #include <time.h>
 #include <pthread.h>
 #include <strings.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/uio.h>
 
 /*****************
  * API Variables *
  *****************/
-int initialized = -1;
-int sys_socket;
+/* Client and server sides are indexed by their start_mode, so that both
+   can live in the same process (see mictcp_sim.h) */
+int initialized[2] = { -1, -1 };
+int sys_socket[2];
 pthread_t listen_th;
-pthread_mutex_t lock;
-unsigned short  loss_rate = 0;
-struct sockaddr_in remote_addr;
-
-/* This is for the buffer */
-TAILQ_HEAD(tailhead, app_buffer_entry) app_buffer_head;
-struct tailhead *headp;
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+int checksum = MICTCP_CHECKSUM;
+struct sockaddr_in remote_addr[2];
+
+/* Side of the calling thread, or of the last initialized one by default */
+static __thread int thread_side = -1;
+static int default_side = CLIENT;
+#define SIDE() (thread_side != -1 ? thread_side : default_side)
+
+/* Impairments of the packets sent over UDP (see mictcp_impair.h) */
+static mictcp_impair impairment = { .loss = MICTCP_LOSS_RATE / 100.0 };
+static pthread_mutex_t impair_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t env_once = PTHREAD_ONCE_INIT;
+static __thread mictcp_rng impair_rng;
+static __thread int impair_seeded = 0;
+static __thread int impair_bad = 0;     /* Gilbert-Elliott state of the thread's channel */
+
+/* Delay line: delayed packets are sent by a helper thread when due */
+struct delayed_packet {
+     unsigned long due;
+     int fd;
+     struct sockaddr_in addr;
+     int size;
+     struct delayed_packet* next;
+     char data[];
+};
+static struct delayed_packet* delay_head = NULL;
+static pthread_mutex_t delay_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delay_cond;
+static pthread_once_t delay_once = PTHREAD_ONCE_INIT;
+
+/* Reference-counted reception buffers: the listener receives each datagram
+   straight into one, and the application buffer keeps references to the
+   payloads inside it rather than copies */
+#define API_RX_BUFFER 2048  /* pooled capacity, a datagram of the default MSS fits */
+#define API_RX_POOL 1024    /* free buffers kept for reuse */
+typedef struct mictcp_packet {
+     int refs;
+     int capacity;
+     struct mictcp_packet* next;    /* free list */
+     char data[];
+} mictcp_packet;
+static mictcp_packet* packet_pool = NULL;
+static int packet_pool_size = 0;
+static pthread_mutex_t packet_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Packet being processed by the listener, whose payloads need no copy */
+static __thread mictcp_packet* current_packet = NULL;
+
+/* Low-latency mode: how long a receiver spins before sleeping (us, 0 to
+   always sleep), and the core of the listening thread (-1 for any) */
+static unsigned long busy_poll = 0;
+static int listener_cpu = -1;
+static int listener_started = 0;
+static int single_cpu = 0;  /* spinning must then yield to the sender */
+
+/* Last SO_RCVTIMEO of each side's socket (ms), to set it only on change */
+static unsigned long rcv_timeout[2] = { ULONG_MAX, ULONG_MAX };
+
+/* Socket buffers of each side (bytes), only ever raised: the kernel default
+   at creation, MICTCP_SOCKET_BUFFER, then set_socket_buffers() */
+#define API_BUFFER_MAX (64 << 20)
+static unsigned long socket_buffer[2];
+static unsigned long socket_buffer_min = 0;
+static pthread_mutex_t socket_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* This is for the buffers, one per socket */
+TAILQ_HEAD(tailhead, app_buffer_entry) app_buffer_heads[MICTCP_SOCKETS];
 struct app_buffer_entry {
-     mic_tcp_payload bf;
+     mic_tcp_payload bf;    /* points inside packet */
+     mictcp_packet* packet; /* reference held by the entry */
+     unsigned long stamp;   /* time of insertion (us) */
+     int stream;            /* stream of the connection */
      TAILQ_ENTRY(app_buffer_entry) entries;
 };
 
+/* Number of entries in each buffer, readable without the lock */
+static int app_buffer_entries[MICTCP_SOCKETS];
+
 /* Condition variable used for passive wait when buffer is empty */
 pthread_cond_t buffer_empty_cond;
 
+/* Generic event used by the protocol to wait for the listening thread */
+pthread_mutex_t event_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+
 /*************************
  * Fonctions Utilitaires *
  *************************/
+static void load_environment(void)
+{
+    /* Trace events are stamped with the protocol's time, virtual in simulation */
+    mictcp_trace_set_clock(get_now_time_usec);
+
+    const char* rate = getenv("MICTCP_LOSS_RATE");
+    if (rate != NULL) {
+        impairment.loss = atof(rate) / 100.0;
+    }
+
+    const char* level = getenv("MICTCP_LOG_LEVEL");
+    if (level != NULL) {
+        if (mictcp_log_parse_level(level) == -1) {
+            MICTCP_LOG(MICTCP_LOG_ERROR, "[MICTCP-CORE] MICTCP_LOG_LEVEL invalide : %s", level);
+        } else {
+            mictcp_log_set_level(mictcp_log_parse_level(level));
+        }
+    }
+
+    const char* spec = getenv("MICTCP_IMPAIR");
+    if (spec != NULL && mictcp_impair_parse(spec, &impairment) == -1) {
+        MICTCP_LOG(MICTCP_LOG_ERROR, "[MICTCP-CORE] MICTCP_IMPAIR invalide : %s", spec);
+    }
+
+    /* Low-latency mode */
+    single_cpu = sysconf(_SC_NPROCESSORS_ONLN) == 1;
+    const char* poll = getenv("MICTCP_BUSY_POLL");
+    if (poll != NULL) {
+        busy_poll = strtoul(poll, NULL, 10);
+    }
+    const char* cpu = getenv("MICTCP_LISTENER_CPU");
+    if (cpu != NULL) {
+        listener_cpu = atoi(cpu);
+    }
+
+    const char* crc = getenv("MICTCP_CHECKSUM");
+    if (crc != NULL) {
+        checksum = atoi(crc) != 0;
+    }
+
+    const char* buffer = getenv("MICTCP_SOCKET_BUFFER");
+    if (buffer != NULL) {
+        socket_buffer_min = strtoul(buffer, NULL, 10);
+    }
+
+    /* Protocol clock: CLOCK_MONOTONIC by default, or the calibrated TSC */
+    const char* clock = getenv("MICTCP_CLOCK");
+    if (clock != NULL && strcmp(clock, "tsc") == 0 && mictcp_clock_use_tsc(1) == -1) {
+        MICTCP_LOG(MICTCP_LOG_WARN, "[MICTCP-CORE] MICTCP_CLOCK : TSC invariant indisponible, CLOCK_MONOTONIC conservée");
+    } else if (clock != NULL && strcmp(clock, "tsc") != 0 && strcmp(clock, "monotonic") != 0) {
+        MICTCP_LOG(MICTCP_LOG_ERROR, "[MICTCP-CORE] MICTCP_CLOCK invalide : %s", clock);
+    }
+
+    /* Event trace, written to the given file on SIGUSR1 */
+    const char* trace = getenv("MICTCP_TRACE");
+    if (trace != NULL && *trace != '\0') {
+        mictcp_trace_enable(1);
+        if (mictcp_trace_dump_on_signal(SIGUSR1, trace) == -1) {
+            MICTCP_LOG(MICTCP_LOG_ERROR, "[MICTCP-CORE] MICTCP_TRACE : signal indisponible");
+        }
+    }
+}
+
+/* A packet of at least capacity bytes with one reference, from the pool when it fits */
+static mictcp_packet* packet_alloc(int capacity)
+{
+    mictcp_packet* packet = NULL;
+
+    if (capacity <= API_RX_BUFFER) {
+        capacity = API_RX_BUFFER;
+        pthread_mutex_lock(&packet_lock);
+        if ((packet = packet_pool) != NULL) {
+            packet_pool = packet->next;
+            packet_pool_size--;
+        }
+        pthread_mutex_unlock(&packet_lock);
+    }
+    if (packet == NULL) {
+        packet = malloc(sizeof(mictcp_packet) + capacity);
+        packet->capacity = capacity;
+    }
+    packet->refs = 1;
+    return packet;
+}
+
+static void packet_hold(mictcp_packet* packet)
+{
+    __atomic_fetch_add(&packet->refs, 1, __ATOMIC_RELAXED);
+}
+
+static void packet_release(mictcp_packet* packet)
+{
+    if (__atomic_sub_fetch(&packet->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+    if (packet->capacity == API_RX_BUFFER) {
+        pthread_mutex_lock(&packet_lock);
+        if (packet_pool_size < API_RX_POOL) {
+            packet->next = packet_pool;
+            packet_pool = packet;
+            packet_pool_size++;
+            packet = NULL;
+        }
+        pthread_mutex_unlock(&packet_lock);
+    }
+    free(packet);
+}
+
+void set_thread_side(start_mode mode)
+{
+    thread_side = mode;
+}
+
+static inline void spin_pause(void)
+{
+    if (single_cpu) {
+        sched_yield();
+    } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+/* Asks the kernel to busy-poll the device queue as well (only effective on
+   real NICs, and above net.core.busy_poll only with CAP_NET_ADMIN) */
+static void apply_busy_poll(int fd)
+{
+    int usec = busy_poll > INT_MAX ? INT_MAX : (int) busy_poll;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1 && busy_poll > 0) {
+        MICTCP_LOG(MICTCP_LOG_INFO, "[MICTCP-CORE] SO_BUSY_POLL refuse, attente active seule");
+    }
+}
+
+/* Raises SO_SNDBUF and SO_RCVBUF of a side's socket (lock held). The kernel
+   caps both at net.core.wmem_max and rmem_max without failing */
+static int grow_socket_buffers(int mode, unsigned long bytes)
+{
+    int size = bytes > API_BUFFER_MAX ? API_BUFFER_MAX : (int) bytes, granted = 0;
+    socklen_t len = sizeof(granted);
+
+    setsockopt(sys_socket[mode], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(sys_socket[mode], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    /* Kept even when capped, so that the same request does not retry */
+    socket_buffer[mode] = size;
+
+    /* The kernel reports twice the size asked, to account for its bookkeeping */
+    getsockopt(sys_socket[mode], SOL_SOCKET, SO_RCVBUF, &granted, &len);
+    if (granted / 2 < size) {
+        MICTCP_LOG(MICTCP_LOG_INFO, "[MICTCP-CORE] Tampons du socket limites a %d octets sur %d (net.core.rmem_max)", granted / 2, size);
+        return -1;
+    }
+    return 0;
+}
+
+static int pin_listener(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (listener_cpu >= 0) {
+        CPU_SET(listener_cpu, &set);
+    } else {
+        int k;
+        for (k = 0; k < CPU_SETSIZE; k++) CPU_SET(k, &set);
+    }
+    if (pthread_setaffinity_np(listen_th, sizeof(set), &set) != 0) {
+        MICTCP_LOG(MICTCP_LOG_WARN, "[MICTCP-CORE] Impossible de fixer le thread de reception sur le coeur %d", listener_cpu);
+        return -1;
+    }
+    return 0;
+}
+
 int initialize_components(start_mode mode)
 {
     int bnd;
     struct hostent * hp;
     struct sockaddr_in local_addr;
 
-    if(initialized != -1) return initialized;
-    if((sys_socket = socket(AF_INET, SOCK_DGRAM, 0)) == -1) return -1;
-    else initialized = 1;
+    thread_side = mode;
+    default_side = mode;
+    pthread_once(&env_once, load_environment);
+
+    if(initialized[mode] != -1) return initialized[mode];
 
-    if((mode == SERVER) & (initialized != -1))
+    if(mode == SERVER)
     {
-        TAILQ_INIT(&app_buffer_head);
+        int k;
+        for (k = 0; k < MICTCP_SOCKETS; k++) TAILQ_INIT(&app_buffer_heads[k]);
         pthread_cond_init(&buffer_empty_cond, 0);
+    }
+
+    if(mictcp_sim_enabled())
+    {
+        /* The simulator replaces the UDP socket */
+        initialized[mode] = 1;
+    }
+    else if((sys_socket[mode] = socket(AF_INET, SOCK_DGRAM, 0)) == -1) return -1;
+    else {
+        int granted = 0;
+        socklen_t len = sizeof(granted);
+        if (busy_poll > 0) apply_busy_poll(sys_socket[mode]);
+        getsockopt(sys_socket[mode], SOL_SOCKET, SO_RCVBUF, &granted, &len);
+        socket_buffer[mode] = granted / 2;
+        if (socket_buffer_min > socket_buffer[mode]) grow_socket_buffers(mode, socket_buffer_min);
+        initialized[mode] = 1;
+    }
+
+    if((mode == SERVER) & (initialized[mode] != -1) & !mictcp_sim_enabled())
+    {
         memset((char *) &local_addr, 0, sizeof(local_addr));
         local_addr.sin_family = AF_INET;
         local_addr.sin_port = htons(API_CS_Port);
         local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-        bnd = bind(sys_socket, (struct sockaddr *) &local_addr, sizeof(local_addr));
+        bnd = bind(sys_socket[mode], (struct sockaddr *) &local_addr, sizeof(local_addr));
 
         if (bnd == -1)
         {
-            initialized = -1;
+            initialized[mode] = -1;
         }
         else
         {
-            memset((char *) &remote_addr, 0, sizeof(remote_addr));
-            remote_addr.sin_family = AF_INET;
-            remote_addr.sin_port = htons(API_SC_Port);
+            memset((char *) &remote_addr[mode], 0, sizeof(remote_addr[mode]));
+            remote_addr[mode].sin_family = AF_INET;
+            remote_addr[mode].sin_port = htons(API_SC_Port);
             hp = gethostbyname("localhost");
-            memcpy (&(remote_addr.sin_addr.s_addr), hp->h_addr, hp->h_length);
-            initialized = 1;
+            memcpy (&(remote_addr[mode].sin_addr.s_addr), hp->h_addr, hp->h_length);
+            initialized[mode] = 1;
         }
 
 
     }
-    else
+    else if(!mictcp_sim_enabled())
     {
-        if(initialized != -1)
+        if(initialized[mode] != -1)
         {
-            memset((char *) &remote_addr, 0, sizeof(remote_addr));
-            remote_addr.sin_family = AF_INET;
-            remote_addr.sin_port = htons(API_CS_Port);
+            memset((char *) &remote_addr[mode], 0, sizeof(remote_addr[mode]));
+            remote_addr[mode].sin_family = AF_INET;
+            remote_addr[mode].sin_port = htons(API_CS_Port);
             hp = gethostbyname("localhost");
-            memcpy (&(remote_addr.sin_addr.s_addr), hp->h_addr, hp->h_length);
+            memcpy (&(remote_addr[mode].sin_addr.s_addr), hp->h_addr, hp->h_length);
 
             memset((char *) &local_addr, 0, sizeof(local_addr));
             local_addr.sin_family = AF_INET;
             local_addr.sin_port = htons(API_SC_Port);
             local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-            bnd = bind(sys_socket, (struct sockaddr *) &local_addr, sizeof(local_addr));
+            bnd = bind(sys_socket[mode], (struct sockaddr *) &local_addr, sizeof(local_addr));
         }
     }
 
-    if((initialized == 1) && (mode == SERVER))
+    if((initialized[mode] == 1) && (mode == SERVER))
     {
+        if (mictcp_sim_enabled()) mictcp_sim_reserve();
         pthread_create (&listen_th, NULL, listening, "1");
+        __atomic_store_n(&listener_started, 1, __ATOMIC_RELEASE);
+        if (listener_cpu >= 0) pin_listener();
     }
 
-    return initialized;
+    return initialized[mode];
 }
 
 
@@ -99,32 +376,52 @@ int IP_send(mic_tcp_pdu pk, mic_tcp_sock_addr addr)
 
     int result = 0;
 
-    if(initialized == -1) {
+    if(initialized[SIDE()] == -1) {
         result = -1;
 
     } else {
         mic_tcp_payload tmp = get_full_stream(pk);
+        MICTCP_TRACE(TRACE_TX, MICTCP_TRACE_NO_SOCKET, &pk.header, pk.payload.size, 0);
         int sent_size =  mic_tcp_core_send(tmp);
 
         free (tmp.data);
 
         /* Correct the sent size */
-        result = (sent_size == -1) ? -1 : sent_size - API_HD_Size;
+        result = (sent_size == -1) ? -1 : sent_size - (tmp.size - pk.payload.size);
     }
 
     return result;
 }
 
-int IP_recv(mic_tcp_pdu* pk, mic_tcp_sock_addr* addr, unsigned long timeout)
+/* Non-blocking reads for up to budget us. Returns the datagram size, or -1
+   if none arrived */
+static int poll_datagram(struct msghdr* msg, unsigned long budget)
+{
+    const unsigned long deadline = mictcp_clock_usec() + budget;
+    int result;
+
+    while ((result = recvmsg(sys_socket[SIDE()], msg, MSG_DONTWAIT)) == -1
+           && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        if (mictcp_clock_usec() >= deadline) break;
+        spin_pause();
+    }
+    return result;
+}
+
+/* Receives one datagram into a packet (one reference for the caller), so
+   that pk->payload points inside it: the kernel copy is the only one */
+static int recv_packet(mic_tcp_pdu* pk, mic_tcp_sock_addr* addr, unsigned long timeout, mictcp_packet** packet)
 {
     int result = -1;
+    int hlen = -1;
 
     struct timeval tv;
-    struct sockaddr_in tmp_addr;
-    socklen_t tmp_addr_size = sizeof(struct sockaddr);
+
+    /* Tail of the datagrams larger than a pooled packet */
+    static __thread char overflow[API_MAX_DATAGRAM];
 
     /* Send data over a fake IP */
-    if(initialized == -1) {
+    if(initialized[SIDE()] == -1) {
         return -1;
     }
 
@@ -133,19 +430,75 @@ int IP_recv(mic_tcp_pdu* pk, mic_tcp_sock_addr* addr, unsigned long timeout)
     /* Convert the remainder to microseconds */
     tv.tv_usec = (timeout - tv.tv_sec * 1000) * 1000;
 
-    /* Create a reception buffer */
-    int buffer_size = API_HD_Size + pk->payload.size;
-    char *buffer = malloc(buffer_size);
+    mictcp_packet* p = packet_alloc(API_RX_BUFFER);
 
-    if ((setsockopt(sys_socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv))) >= 0) {
-       result = recvfrom(sys_socket, buffer, buffer_size, 0, (struct sockaddr *)&tmp_addr, &tmp_addr_size);
+    if (mictcp_sim_enabled()) {
+        /* The simulator hands out copies of its own */
+        result = mictcp_sim_recv(SIDE(), overflow, API_MAX_DATAGRAM, timeout);
+        if (result > API_RX_BUFFER) {
+            packet_release(p);
+            p = packet_alloc(result);
+        }
+        if (result > 0) memcpy(p->data, overflow, result);
+    } else {
+        struct iovec iov[2] = {
+            { .iov_base = p->data, .iov_len = API_RX_BUFFER },
+            { .iov_base = overflow, .iov_len = API_MAX_DATAGRAM - API_RX_BUFFER }
+        };
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = 2 };
+        unsigned long remaining = timeout;
+        int expired = 0;
+
+        /* Low-latency mode: spin first, then sleep for what is left of the timeout */
+        if (busy_poll > 0) {
+            const unsigned long spin = (timeout == 0 || timeout * 1000 > busy_poll) ? busy_poll : timeout * 1000;
+            result = poll_datagram(&msg, spin);
+            if (result == -1 && timeout > 0) {
+                const unsigned long spun = (spin + 999) / 1000;
+                expired = timeout <= spun;
+                remaining = expired ? 0 : timeout - spun;
+                tv.tv_sec = remaining / 1000;
+                tv.tv_usec = (remaining - tv.tv_sec * 1000) * 1000;
+            }
+        }
+        /* The timeout only changes between the handshake and the data phase:
+           SO_RCVTIMEO is set again only when it does */
+        if (result == -1 && !expired
+            && (rcv_timeout[SIDE()] == remaining
+                || setsockopt(sys_socket[SIDE()], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) >= 0)) {
+            rcv_timeout[SIDE()] = remaining;
+            result = recvmsg(sys_socket[SIDE()], &msg, 0);
+        }
+        if (expired) errno = EAGAIN;
+        if (result > API_RX_BUFFER) {
+            /* Larger than the MSS allows by default: gathered into a packet of its own */
+            mictcp_packet* large = packet_alloc(result);
+            memcpy(large->data, p->data, API_RX_BUFFER);
+            memcpy(large->data + API_RX_BUFFER, overflow, result - API_RX_BUFFER);
+            packet_release(p);
+            p = large;
+        }
     }
 
+    /* One clock read per datagram, shared by everything that handles it
+       and by the trace events that follow */
+    if (!mictcp_sim_enabled()) mictcp_clock_tick();
+    mictcp_trace_time(get_coarse_time_usec());
+
     if (result != -1) {
-        /* Create the mic_tcp_pdu */
-        memcpy (&(pk->header), buffer, API_HD_Size);
-        pk->payload.size = result - API_HD_Size;
-        memcpy (pk->payload.data, buffer + API_HD_Size, pk->payload.size);
+        /* Decode the header, malformed or corrupted packets are dropped
+           (the packet always holds a full header worth of readable bytes) */
+        hlen = mictcp_wire_decode((unsigned char *) p->data, result, &(pk->header));
+        if (hlen != -1 && check_stream(p->data, result, hlen) == -1) {
+            hlen = -1;
+        }
+    }
+
+    if (hlen != -1) {
+        /* The payload is left in place */
+        pk->payload.data = p->data + hlen;
+        pk->payload.size = result - hlen;
+        *packet = p;
 
         /* Generate a stub address */
         if (addr != NULL) {
@@ -155,11 +508,34 @@ int IP_recv(mic_tcp_pdu* pk, mic_tcp_sock_addr* addr, unsigned long timeout)
         }
 
         /* Correct the receved size */
-        result -= API_HD_Size;
+        result = pk->payload.size;
+        MICTCP_TRACE(TRACE_RX, MICTCP_TRACE_NO_SOCKET, &pk->header, result, 0);
+    } else {
+        if (result == -1 && timeout > 0 && errno == EAGAIN) {
+            MICTCP_TRACE(TRACE_TIMER, MICTCP_TRACE_NO_SOCKET, NULL, 0, timeout);
+        }
+        packet_release(p);
+        result = -1;
     }
 
-    /* Free the reception buffer */
-    free(buffer);
+    return result;
+}
+
+int IP_recv(mic_tcp_pdu* pk, mic_tcp_sock_addr* addr, unsigned long timeout)
+{
+    mic_tcp_payload buffer = pk->payload;
+    mictcp_packet* packet;
+
+    int result = recv_packet(pk, addr, timeout, &packet);
+
+    if (result != -1) {
+        /* Copy of the payload into the caller's buffer (handshakes and ACKs) */
+        result = min_size(result, buffer.size);
+        if (result > 0) memcpy(buffer.data, pk->payload.data, result);
+        packet_release(packet);
+    }
+    pk->payload.data = buffer.data;
+    pk->payload.size = result != -1 ? result : buffer.size;
 
     return result;
 }
@@ -168,21 +544,61 @@ mic_tcp_payload get_full_stream(mic_tcp_pdu pk)
 {
     /* Get a full packet from data and header */
     mic_tcp_payload tmp;
-    tmp.size = API_HD_Size + pk.payload.size;
-    tmp.data = malloc (tmp.size);
+    unsigned char *hd;
+    uint32_t crc = 0;
+    int hlen = API_HD_Size;
+
+    if (checksum) hlen = API_HD_Size + API_CRC_Size;
 
-    memcpy (tmp.data, &pk.header, API_HD_Size);
-    memcpy (tmp.data + API_HD_Size, pk.payload.data, pk.payload.size);
+    tmp.size = hlen + pk.payload.size;
+    tmp.data = malloc (tmp.size);
+    hd = (unsigned char *) tmp.data;
+
+    mictcp_wire_encode(&pk.header, hd, hlen);
+    if (checksum) {
+        /* The checksum is computed with its own field zeroed, and over
+           the payload while it is copied */
+        mictcp_wire_pad(hd, mictcp_wire_put_option(hd, API_HD_Size, MICTCP_OPT_CRC32C, &crc, sizeof(crc)));
+        crc = mictcp_crc32c(0, hd, hlen);
+        crc = htonl(mictcp_crc32c_copy(crc, tmp.data + hlen, pk.payload.data, pk.payload.size));
+        memcpy (hd + API_HD_Size + 2, &crc, sizeof(crc));
+    } else {
+        memcpy (tmp.data + hlen, pk.payload.data, pk.payload.size);
+    }
 
     return tmp;
 }
 
+int check_stream(char* packet, int size, int hlen)
+{
+    /* Packets without a checksum option are accepted as is */
+    int value_size = 0;
+    unsigned char *value = (unsigned char *) mictcp_wire_get_option((unsigned char *) packet, hlen, MICTCP_OPT_CRC32C, &value_size);
+    uint32_t expected, crc = 0;
+
+    if (value == NULL || value_size != sizeof(crc)) return 0;
+
+    memcpy (&expected, value, sizeof(expected));
+    memcpy (value, &crc, sizeof(crc));
+    crc = htonl(mictcp_crc32c(0, packet, size));
+    memcpy (value, &expected, sizeof(expected));
+
+    if (crc != expected) {
+        MICTCP_LOG(MICTCP_LOG_WARN, "[MICTCP-CORE] Paquet corrompu");
+        return -1;
+    }
+    return 0;
+}
+
 mic_tcp_payload get_mic_tcp_data(ip_payload buff)
 {
+    mic_tcp_header hd;
     mic_tcp_payload tmp;
-    tmp.size = buff.size-API_HD_Size;
+    int hlen = mictcp_wire_decode((unsigned char *) buff.data, buff.size, &hd);
+    if (hlen == -1) hlen = buff.size;
+    tmp.size = buff.size-hlen;
     tmp.data = malloc(tmp.size);
-    memcpy(tmp.data, buff.data+API_HD_Size, tmp.size);
+    memcpy(tmp.data, buff.data+hlen, tmp.size);
     return tmp;
 }
 
@@ -191,7 +607,7 @@ mic_tcp_header get_mic_tcp_header(ip_payload packet)
 {
     /* Get a struct header from an incoming packet */
     mic_tcp_header tmp;
-    memcpy(&tmp, packet.data, API_HD_Size);
+    mictcp_wire_decode((unsigned char *) packet.data, packet.size, &tmp);
     return tmp;
 }
 
@@ -199,39 +615,150 @@ int full_send(mic_tcp_payload buff)
 {
     int result = 0;
 
-    result = sendto(sys_socket, buff.data, buff.size, 0, (struct sockaddr *)&remote_addr, sizeof(remote_addr));
+    result = sendto(sys_socket[SIDE()], buff.data, buff.size, 0, (struct sockaddr *)&remote_addr[SIDE()], sizeof(remote_addr[SIDE()]));
 
     return result;
 }
 
+static unsigned long monotonic_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void* delay_line(void* arg)
+{
+    struct delayed_packet* packet;
+    struct timespec ts;
+
+    pthread_mutex_lock(&delay_lock);
+    while (1) {
+        packet = delay_head;
+        if (packet == NULL) {
+            pthread_cond_wait(&delay_cond, &delay_lock);
+        } else if (packet->due > monotonic_usec()) {
+            ts.tv_sec = packet->due / 1000000;
+            ts.tv_nsec = (packet->due % 1000000) * 1000;
+            pthread_cond_timedwait(&delay_cond, &delay_lock, &ts);
+        } else {
+            delay_head = packet->next;
+            pthread_mutex_unlock(&delay_lock);
+            sendto(packet->fd, packet->data, packet->size, 0, (struct sockaddr *)&packet->addr, sizeof(packet->addr));
+            free(packet);
+            pthread_mutex_lock(&delay_lock);
+        }
+    }
+    return NULL;
+}
+
+static void start_delay_line(void)
+{
+    pthread_condattr_t attr;
+    pthread_t th;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&delay_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_create(&th, NULL, delay_line, NULL);
+    pthread_detach(th);
+}
+
+static void delay_send(mic_tcp_payload buff, unsigned long delay)
+{
+    struct delayed_packet *packet, **pos;
+
+    pthread_once(&delay_once, start_delay_line);
+
+    packet = malloc(sizeof(struct delayed_packet) + buff.size);
+    packet->due = monotonic_usec() + delay;
+    packet->fd = sys_socket[SIDE()];
+    packet->addr = remote_addr[SIDE()];
+    packet->size = buff.size;
+    memcpy(packet->data, buff.data, buff.size);
+
+    /* Packets due at the same time keep their sending order */
+    pthread_mutex_lock(&delay_lock);
+    for (pos = &delay_head; *pos != NULL && (*pos)->due <= packet->due; pos = &(*pos)->next);
+    packet->next = *pos;
+    *pos = packet;
+    pthread_cond_signal(&delay_cond);
+    pthread_mutex_unlock(&delay_lock);
+}
+
 int mic_tcp_core_send(mic_tcp_payload buff)
 {
-    int random = rand();
+    /* Losses are drawn by the simulated links when the simulator is on */
+    if (mictcp_sim_enabled()) {
+        return mictcp_sim_send(SIDE(), buff.data, buff.size);
+    }
+
     int result = buff.size;
-    int lr_tresh = (int) round(((float)loss_rate/100.0)*RAND_MAX);
+    unsigned long delays[MICTCP_IMPAIR_COPIES];
+    mictcp_impair cfg;
+    int copies, k;
+
+    pthread_once(&env_once, load_environment);
+    if (!impair_seeded) {
+        mictcp_rng_seed(&impair_rng, monotonic_usec() ^ (uint64_t)(uintptr_t) &impair_rng);
+        impair_seeded = 1;
+    }
+    pthread_mutex_lock(&impair_lock);
+    cfg = impairment;
+    pthread_mutex_unlock(&impair_lock);
+
+    copies = mictcp_impair_apply(&cfg, &impair_bad, &impair_rng, delays);
+    if (copies == 0) {
+        MICTCP_TRACE(TRACE_DROP, MICTCP_TRACE_NO_SOCKET, NULL, buff.size, 0);
+        MICTCP_LOG(MICTCP_LOG_INFO, "[MICTCP-CORE] Perte du paquet");
+    }
 
-    if(random > lr_tresh) {
-        result = sendto(sys_socket, buff.data, buff.size, 0, (struct sockaddr *)&remote_addr, sizeof(struct sockaddr));
-    } else {
-        printf("[MICTCP-CORE] Perte du paquet\n");
+    for (k = 0; k < copies; k++) {
+        if (delays[k] > 0) {
+            delay_send(buff, delays[k]);
+        } else {
+            result = sendto(sys_socket[SIDE()], buff.data, buff.size, 0, (struct sockaddr *)&remote_addr[SIDE()], sizeof(struct sockaddr));
+        }
     }
 
     return result;
 }
 
-int app_buffer_get(mic_tcp_payload app_buff)
+int app_buffer_get(int socket, mic_tcp_payload app_buff)
+{
+    return app_buffer_get_stamped(socket, app_buff, NULL);
+}
+
+int app_buffer_get_stamped(int socket, mic_tcp_payload app_buff, unsigned long* stamp)
+{
+    return app_buffer_get_stream(socket, app_buff, stamp, NULL);
+}
+
+/* Takes the first entry out of the buffer of a socket, waiting for one if needed */
+static struct app_buffer_entry* app_buffer_take(int socket)
 {
+    struct tailhead* head = &app_buffer_heads[socket];
     /* A pointer to a buffer entry */
     struct app_buffer_entry * entry;
 
-    /* The actual size passed to the application */
-    int result = 0;
+    /* The simulator waits in virtual time, the buffer can only grow meanwhile */
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_wait(app_buffer_ready, &socket);
+    } else if (busy_poll > 0 && app_buffer_count(socket) == 0) {
+        /* Low-latency mode: spin on the queue before parking on the condition */
+        const unsigned long deadline = mictcp_clock_usec() + busy_poll;
+        unsigned int k = 0;
+        while (app_buffer_count(socket) == 0 && ((++k & 63) != 0 || mictcp_clock_usec() < deadline)) {
+            spin_pause();
+        }
+    }
 
     /* Lock a mutex to protect the buffer from corruption */
     pthread_mutex_lock(&lock);
 
     /* If the buffer is empty, we wait for insertion */
-    while(app_buffer_head.tqh_first == NULL) {
+    while(head->tqh_first == NULL) {
           pthread_cond_wait(&buffer_empty_cond, &lock);
     }
 
@@ -241,40 +768,129 @@ int app_buffer_get(mic_tcp_payload app_buff)
     */
 
     /* The entry we want is the first one in the buffer */
-    entry = app_buffer_head.tqh_first;
-
-    /* How much data are we going to deliver to the application ? */
-    result = min_size(entry->bf.size, app_buff.size);
-
-    /* We copy the actual data in the application allocated buffer */
-    memcpy(app_buff.data, entry->bf.data, result);
+    entry = head->tqh_first;
 
     /* We remove the entry from the buffer */
-    TAILQ_REMOVE(&app_buffer_head, entry, entries);
+    TAILQ_REMOVE(head, entry, entries);
+    __atomic_fetch_sub(&app_buffer_entries[socket], 1, __ATOMIC_RELAXED);
 
     /* Release the mutex */
     pthread_mutex_unlock(&lock);
 
+    return entry;
+}
+
+int app_buffer_get_stream(int socket, mic_tcp_payload app_buff, unsigned long* stamp, int* stream)
+{
+    struct app_buffer_entry * entry = app_buffer_take(socket);
+
+    /* How much data are we going to deliver to the application ? */
+    int result = min_size(entry->bf.size, app_buff.size);
+
+    /* We copy the actual data in the application allocated buffer */
+    memcpy(app_buff.data, entry->bf.data, result);
+    if (stamp != NULL) *stamp = entry->stamp;
+    if (stream != NULL) *stream = entry->stream;
+
     /* Clean up memory */
-    free(entry->bf.data);
+    packet_release(entry->packet);
     free(entry);
 
     return result;
 }
 
-void app_buffer_put(mic_tcp_payload bf)
+int app_buffer_get_loan(int socket, mic_tcp_payload* app_buff, unsigned long* stamp, int* stream, void** packet)
+{
+    struct app_buffer_entry * entry = app_buffer_take(socket);
+
+    /* The reference of the entry goes to the application */
+    *app_buff = entry->bf;
+    *packet = entry->packet;
+    if (stamp != NULL) *stamp = entry->stamp;
+    if (stream != NULL) *stream = entry->stream;
+    free(entry);
+
+    return app_buff->size;
+}
+
+void app_buffer_release(void* packet)
+{
+    packet_release((mictcp_packet*) packet);
+}
+
+int app_buffer_get_many(int socket, mic_tcp_payload* app_buffs, unsigned long* stamps, int count)
+{
+    struct tailhead* head = &app_buffer_heads[socket];
+    /* Entries taken out of the buffer, freed once the lock is released */
+    struct app_buffer_entry * entries[MICTCP_RECV_MANY_MAX];
+    int k, taken = 0;
+
+    if (count <= 0) return 0;
+    if (count > MICTCP_RECV_MANY_MAX) count = MICTCP_RECV_MANY_MAX;
+
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_wait(app_buffer_ready, &socket);
+    }
+
+    pthread_mutex_lock(&lock);
+
+    /* Wait for the first entry only, then take every queued one
+       (up to count) under the same lock */
+    while(head->tqh_first == NULL) {
+          pthread_cond_wait(&buffer_empty_cond, &lock);
+    }
+    while (taken < count && head->tqh_first != NULL) {
+        entries[taken] = head->tqh_first;
+        TAILQ_REMOVE(head, entries[taken], entries);
+        taken++;
+    }
+    __atomic_fetch_sub(&app_buffer_entries[socket], taken, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&lock);
+
+    for (k = 0; k < taken; k++) {
+        app_buffs[k].size = min_size(entries[k]->bf.size, app_buffs[k].size);
+        memcpy(app_buffs[k].data, entries[k]->bf.data, app_buffs[k].size);
+        if (stamps != NULL) stamps[k] = entries[k]->stamp;
+        packet_release(entries[k]->packet);
+        free(entries[k]);
+    }
+
+    return taken;
+}
+
+void app_buffer_put(int socket, mic_tcp_payload bf)
+{
+    app_buffer_put_stream(socket, bf, 0);
+}
+
+void app_buffer_put_stream(int socket, mic_tcp_payload bf, int stream)
 {
     /* Prepare a buffer entry to store the data */
     struct app_buffer_entry * entry = malloc(sizeof(struct app_buffer_entry));
-    entry->bf.size = bf.size;
-    entry->bf.data = malloc(bf.size);
-    memcpy(entry->bf.data, bf.data, bf.size);
+    entry->stamp = get_coarse_time_usec();
+    entry->stream = stream;
+
+    /* Data inside the packet being processed is referenced, not copied;
+       reassembled or decompressed data gets a packet of its own */
+    if (current_packet != NULL && bf.data >= current_packet->data
+        && bf.data + bf.size <= current_packet->data + current_packet->capacity) {
+        packet_hold(current_packet);
+        entry->packet = current_packet;
+        entry->bf = bf;
+    } else {
+        entry->packet = packet_alloc(bf.size);
+        entry->bf.data = entry->packet->data;
+        entry->bf.size = bf.size;
+        memcpy(entry->bf.data, bf.data, bf.size);
+    }
 
     /* Lock a mutex to protect the buffer from corruption */
     pthread_mutex_lock(&lock);
 
     /* Insert the packet in the buffer, at the end of it */
-    TAILQ_INSERT_TAIL(&app_buffer_head, entry, entries);
+    TAILQ_INSERT_TAIL(&app_buffer_heads[socket], entry, entries);
+    __atomic_fetch_add(&app_buffer_entries[socket], 1, __ATOMIC_RELAXED);
 
     /* Release the mutex */
     pthread_mutex_unlock(&lock);
@@ -282,6 +898,60 @@ void app_buffer_put(mic_tcp_payload bf)
     /* We can now signal to any potential thread waiting that the buffer is
        no longer empty */
     pthread_cond_broadcast(&buffer_empty_cond);
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_notify();
+    }
+}
+
+void app_buffer_clear(int socket)
+{
+    struct tailhead* head = &app_buffer_heads[socket];
+    struct app_buffer_entry * entry;
+
+    pthread_mutex_lock(&lock);
+    while ((entry = head->tqh_first) != NULL) {
+        TAILQ_REMOVE(head, entry, entries);
+        packet_release(entry->packet);
+        free(entry);
+    }
+    __atomic_store_n(&app_buffer_entries[socket], 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&lock);
+}
+
+int app_buffer_count(int socket)
+{
+    return __atomic_load_n(&app_buffer_entries[socket], __ATOMIC_RELAXED);
+}
+
+int app_buffer_ready(void* arg)
+{
+    return app_buffer_heads[*(int*) arg].tqh_first != NULL;
+}
+
+void wait_event(int (*ready)(void*), void* arg)
+{
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_wait(ready, arg);
+        return;
+    }
+
+    pthread_mutex_lock(&event_lock);
+    while (!ready(arg)) {
+        pthread_cond_wait(&event_cond, &event_lock);
+    }
+    pthread_mutex_unlock(&event_lock);
+}
+
+void signal_event(void)
+{
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_notify();
+        return;
+    }
+
+    pthread_mutex_lock(&event_lock);
+    pthread_cond_broadcast(&event_cond);
+    pthread_mutex_unlock(&event_lock);
 }
 
 
@@ -292,26 +962,25 @@ void* listening(void* arg)
     int recv_size;
     mic_tcp_sock_addr remote;
 
-    pthread_mutex_init(&lock, NULL);
-
-    printf("[MICTCP-CORE] Demarrage du thread de reception reseau...\n");
-
-    const int payload_size = 1500 - API_HD_Size;
-    pdu_tmp.payload.size = payload_size;
-    pdu_tmp.payload.data = malloc(payload_size);
+    thread_side = SERVER;
+    if (mictcp_sim_enabled()) mictcp_sim_attach();
 
+    MICTCP_LOG(MICTCP_LOG_INFO, "[MICTCP-CORE] Demarrage du thread de reception reseau...");
 
     while(1)
     {
-        pdu_tmp.payload.size = payload_size;
-        recv_size = IP_recv(&pdu_tmp, &remote, 0);
+        /* Any datagram fits: segments larger than the negotiated MSS are not truncated */
+        recv_size = recv_packet(&pdu_tmp, &remote, 0, &current_packet);
 
         if(recv_size != -1)
         {
             process_received_PDU(pdu_tmp, remote);
+            /* The application buffer keeps its own references */
+            packet_release(current_packet);
+            current_packet = NULL;
         } else {
             /* This should never happen */
-            printf("Error in recv\n");
+            MICTCP_LOG(MICTCP_LOG_ERROR, "[MICTCP-CORE] Error in recv");
         }
     }
 }
@@ -319,7 +988,81 @@ void* listening(void* arg)
 
 void set_loss_rate(unsigned short rate)
 {
-    loss_rate = rate;
+    pthread_once(&env_once, load_environment);
+    pthread_mutex_lock(&impair_lock);
+    impairment.loss = rate / 100.0;
+    pthread_mutex_unlock(&impair_lock);
+}
+
+unsigned short get_loss_rate(void)
+{
+    mictcp_impair impair;
+    get_impairment(&impair);
+    return (unsigned short) round(impair.loss * 100.0);
+}
+
+void set_impairment(const mictcp_impair* impair)
+{
+    pthread_once(&env_once, load_environment);
+    pthread_mutex_lock(&impair_lock);
+    impairment = *impair;
+    pthread_mutex_unlock(&impair_lock);
+}
+
+void get_impairment(mictcp_impair* impair)
+{
+    pthread_once(&env_once, load_environment);
+    pthread_mutex_lock(&impair_lock);
+    *impair = impairment;
+    pthread_mutex_unlock(&impair_lock);
+}
+
+void set_checksum(int enabled)
+{
+    /* Loaded first, so that the environment does not override it later */
+    pthread_once(&env_once, load_environment);
+    checksum = enabled;
+}
+
+void set_busy_poll(unsigned long usec)
+{
+    int mode;
+
+    pthread_once(&env_once, load_environment);
+    busy_poll = usec;
+    for (mode = CLIENT; mode <= SERVER; mode++) {
+        if (initialized[mode] == 1 && !mictcp_sim_enabled()) apply_busy_poll(sys_socket[mode]);
+    }
+}
+
+int set_listener_cpu(int cpu)
+{
+    pthread_once(&env_once, load_environment);
+    listener_cpu = cpu;
+    return __atomic_load_n(&listener_started, __ATOMIC_ACQUIRE) ? pin_listener() : 0;
+}
+
+int set_socket_buffers(unsigned long bytes)
+{
+    const int mode = SIDE();
+    int result = 0;
+
+    if (initialized[mode] != 1 || mictcp_sim_enabled()) return -1;
+    pthread_mutex_lock(&socket_buffer_lock);
+    if (bytes > socket_buffer[mode]) result = grow_socket_buffers(mode, bytes);
+    pthread_mutex_unlock(&socket_buffer_lock);
+    return result;
+}
+
+void sleep_usec(unsigned long usec)
+{
+    struct timespec ts = { .tv_sec = usec / 1000000, .tv_nsec = (usec % 1000000) * 1000 };
+
+    if (mictcp_sim_enabled()) {
+        mictcp_sim_sleep_usec(usec);
+        return;
+    }
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR);
 }
 
 void print_header(mic_tcp_pdu bf)
@@ -335,9 +1078,15 @@ unsigned long get_now_time_msec()
 
 unsigned long get_now_time_usec()
 {
-    struct timespec now_time;
-    clock_gettime( CLOCK_REALTIME, &now_time);
-    return ((unsigned long)((now_time.tv_nsec / 1000) + (now_time.tv_sec * 1000000)));
+    const unsigned long now = mictcp_sim_enabled() ? mictcp_sim_now_usec() : mictcp_clock_usec();
+    mictcp_trace_time(now);
+    return now;
+}
+
+unsigned long get_coarse_time_usec()
+{
+    if (mictcp_sim_enabled()) return mictcp_sim_now_usec();
+    return mictcp_clock_coarse_usec();
 }
 
 int min_size(int s1, int s2)
@@ -0,0 +1,407 @@
+#include <api/mictcp_crc32c.h>
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Reflected CRC-32C polynomial */
+#define POLY 0x82f63b78
+
+/* Longest block of each of the three interleaved hardware streams, and
+   number of halved block sizes used for the tail */
+#define SHORT 256
+#define TIERS 4
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t crc_table[8][256];
+static uint32_t crc_zeros[TIERS][4][256];
+static uint64_t crc_fold[7][2];      /* Folding constants over n 64-byte blocks */
+static uint64_t crc_lanes[4][2];     /* and from each 16-byte lane of a 64-byte block */
+static uint32_t (*crc_fn)(uint32_t, const void*, size_t);
+static uint32_t (*crc_copy_fn)(uint32_t, void*, const void*, size_t);
+static const char* crc_name;
+
+/*************************
+ * Software (slice-by-8) *
+ *************************/
+
+static uint32_t crc32c_sw_raw(uint32_t crc, const unsigned char* p, size_t size)
+{
+    /* Head, up to an 8-byte boundary */
+    while (size && ((uintptr_t) p & 7)) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        size--;
+    }
+
+    while (size >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        word ^= crc;
+        crc = crc_table[7][word & 0xff]
+            ^ crc_table[6][(word >> 8) & 0xff]
+            ^ crc_table[5][(word >> 16) & 0xff]
+            ^ crc_table[4][(word >> 24) & 0xff]
+            ^ crc_table[3][(word >> 32) & 0xff]
+            ^ crc_table[2][(word >> 40) & 0xff]
+            ^ crc_table[1][(word >> 48) & 0xff]
+            ^ crc_table[0][word >> 56];
+        p += 8;
+        size -= 8;
+    }
+
+    while (size--) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+/*********************************
+ * Zero-extension (shift) tables *
+ *********************************/
+
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+    int n;
+    for (n = 0; n < 32; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/* Operator appending len zero bytes to a raw crc (len must be a power of two) */
+static void crc32c_zeros_op(uint32_t* even, size_t len)
+{
+    uint32_t odd[32];
+    uint32_t row = 1;
+    int n;
+
+    odd[0] = POLY;
+    for (n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd);   /* 2 zero bits */
+    gf2_matrix_square(odd, even);   /* 4 zero bits */
+
+    do {
+        gf2_matrix_square(even, odd);
+        len >>= 1;
+        if (len == 0) return;
+        gf2_matrix_square(odd, even);
+        len >>= 1;
+    } while (len);
+
+    memcpy(even, odd, sizeof(odd));
+}
+
+static void crc32c_zeros(uint32_t zeros[][256], size_t len)
+{
+    uint32_t op[32];
+    uint32_t n;
+
+    crc32c_zeros_op(op, len);
+    for (n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+static inline uint32_t crc32c_shift(uint32_t zeros[][256], uint32_t crc)
+{
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff]
+         ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+/****************************
+ * Hardware (SSE4.2 crc32q) *
+ ****************************/
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static inline uint64_t crc32c_hw_3way(uint64_t crc0, const unsigned char* p, size_t block, uint32_t zeros[][256])
+{
+    uint64_t crc1 = 0, crc2 = 0, w0, w1, w2;
+    const unsigned char* end = p + block;
+
+    do {
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + block, 8);
+        memcpy(&w2, p + 2 * block, 8);
+        crc0 = _mm_crc32_u64(crc0, w0);
+        crc1 = _mm_crc32_u64(crc1, w1);
+        crc2 = _mm_crc32_u64(crc2, w2);
+        p += 8;
+    } while (p < end);
+
+    crc0 = crc32c_shift(zeros, (uint32_t) crc0) ^ crc1;
+    return crc32c_shift(zeros, (uint32_t) crc0) ^ crc2;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const void* data, size_t size)
+{
+    const unsigned char* p = data;
+    uint64_t crc0 = crc ^ 0xffffffff;
+    int k;
+
+    while (size && ((uintptr_t) p & 7)) {
+        crc0 = _mm_crc32_u8(crc0, *p++);
+        size--;
+    }
+
+    /* Three independent streams hide the latency of the crc32 instruction.
+       Blocks shrink by halves so that a packet needs few combine steps. */
+    while (size >= 3 * SHORT) {
+        crc0 = crc32c_hw_3way(crc0, p, SHORT, crc_zeros[0]);
+        p += 3 * SHORT;
+        size -= 3 * SHORT;
+    }
+    for (k = 1; k < TIERS; k++) {
+        const size_t block = SHORT >> k;
+        if (size >= 3 * block) {
+            crc0 = crc32c_hw_3way(crc0, p, block, crc_zeros[k]);
+            p += 3 * block;
+            size -= 3 * block;
+        }
+    }
+
+    while (size >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        crc0 = _mm_crc32_u64(crc0, w);
+        p += 8;
+        size -= 8;
+    }
+
+    while (size--) {
+        crc0 = _mm_crc32_u8(crc0, *p++);
+    }
+
+    return (uint32_t) crc0 ^ 0xffffffff;
+}
+
+/****************************************************
+ * Carry-less multiply folding (AVX-512 vpclmulqdq) *
+ ****************************************************/
+
+/* x^n mod P, reflected */
+static uint32_t crc32c_xpow(size_t n)
+{
+    uint32_t r = 0x80000000;
+    while (n--) r = (r & 1) ? (r >> 1) ^ POLY : r >> 1;
+    return r;
+}
+
+/* Constants moving a 16-byte lane the given number of bits forward: the
+   carry-less product of two reflected halves counts one extra x, hence the -1 */
+static void crc32c_fold_constants(uint64_t k[2], size_t bits)
+{
+    k[0] = (uint64_t) crc32c_xpow(bits + 64 - 1) << 32;
+    k[1] = (uint64_t) crc32c_xpow(bits - 1) << 32;
+}
+
+/* Same constants in the four lanes */
+#define CRC_FOLD(n) _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i*) crc_fold[n]))
+
+__attribute__((target("avx512f,vpclmulqdq")))
+static inline __m512i crc32c_fold512(__m512i x, __m512i k, __m512i next)
+{
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),
+                                     _mm512_clmulepi64_epi128(x, k, 0x11), next, 0x96);
+}
+
+__attribute__((target("pclmul")))
+static inline __m128i crc32c_fold128(__m128i x, __m128i k, __m128i next)
+{
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+                                       _mm_clmulepi64_si128(x, k, 0x11)), next);
+}
+
+/* Loads 64 bytes, also storing them at q when copying */
+__attribute__((target("avx512f")))
+static inline __m512i crc32c_load512(const unsigned char* p, unsigned char* q, const int copy)
+{
+    const __m512i v = _mm512_loadu_si512(p);
+    if (copy) _mm512_storeu_si512(q, v);
+    return v;
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2"), always_inline))
+static inline uint32_t crc32c_clmul_body(uint32_t crc, unsigned char* q, const void* data, size_t size, const int copy)
+{
+    const unsigned char* p = data;
+    __m512i x0, x1, x2, x3, acc;
+    __m128i y;
+    uint64_t crc0;
+    size_t n, i;
+
+    if (size < 256) {
+        if (copy) memcpy(q, p, size);
+        return crc32c_hw(crc, data, size);
+    }
+
+    /* Four 64-byte accumulators, the initial crc entering the first bytes */
+    x0 = _mm512_xor_si512(crc32c_load512(p, q, copy), _mm512_maskz_set1_epi32(1, crc ^ 0xffffffff));
+    x1 = crc32c_load512(p + 64, q + 64, copy);
+    x2 = crc32c_load512(p + 128, q + 128, copy);
+    x3 = crc32c_load512(p + 192, q + 192, copy);
+    p += 256;
+    q += 256;
+    size -= 256;
+
+    while (size >= 256) {
+        const __m512i k = CRC_FOLD(4);
+        x0 = crc32c_fold512(x0, k, crc32c_load512(p, q, copy));
+        x1 = crc32c_fold512(x1, k, crc32c_load512(p + 64, q + 64, copy));
+        x2 = crc32c_fold512(x2, k, crc32c_load512(p + 128, q + 128, copy));
+        x3 = crc32c_fold512(x3, k, crc32c_load512(p + 192, q + 192, copy));
+        p += 256;
+        q += 256;
+        size -= 256;
+    }
+
+    /* Every accumulator and remaining 64-byte block moves onto the last
+       block in one independent fold each, rather than one after the other */
+    n = size / 64;
+    acc = n ? crc32c_load512(p + 64 * (n - 1), q + 64 * (n - 1), copy) : x3;
+    for (i = 0; i + 1 < n; i++) {
+        acc = crc32c_fold512(crc32c_load512(p + 64 * i, q + 64 * i, copy), CRC_FOLD(n - 1 - i), acc);
+    }
+    if (n) acc = crc32c_fold512(x3, CRC_FOLD(n), acc);
+    acc = crc32c_fold512(x2, CRC_FOLD(n + 1), acc);
+    acc = crc32c_fold512(x1, CRC_FOLD(n + 2), acc);
+    acc = crc32c_fold512(x0, CRC_FOLD(n + 3), acc);
+    p += 64 * n;
+    q += 64 * n;
+    size -= 64 * n;
+
+    /* Down to 16 bytes: the last lane is kept, the others move onto it */
+    x0 = crc32c_fold512(acc, _mm512_loadu_si512(crc_lanes), _mm512_setzero_si512());
+    y = _mm_xor_si128(_mm_xor_si128(_mm512_extracti32x4_epi32(x0, 0), _mm512_extracti32x4_epi32(x0, 1)),
+                      _mm_xor_si128(_mm512_extracti32x4_epi32(x0, 2), _mm512_extracti32x4_epi32(acc, 3)));
+    while (size >= 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*) p);
+        if (copy) _mm_storeu_si128((__m128i*) q, v);
+        y = crc32c_fold128(y, _mm_loadu_si128((const __m128i*) crc_lanes[2]), v);
+        p += 16;
+        q += 16;
+        size -= 16;
+    }
+    if (copy) memcpy(q, p, size);
+
+    /* The remaining 16 bytes have the same crc as the whole data so far */
+    crc0 = _mm_crc32_u64(0, (uint64_t) _mm_cvtsi128_si64(y));
+    crc0 = _mm_crc32_u64(crc0, (uint64_t) _mm_extract_epi64(y, 1));
+    if (size >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        crc0 = _mm_crc32_u64(crc0, w);
+        p += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc0 = _mm_crc32_u8(crc0, *p++);
+    }
+    return (uint32_t) crc0 ^ 0xffffffff;
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2")))
+static uint32_t crc32c_clmul(uint32_t crc, const void* data, size_t size)
+{
+    /* Nothing is stored when not copying */
+    return crc32c_clmul_body(crc, (unsigned char*) data, data, size, 0);
+}
+
+__attribute__((target("avx512f,vpclmulqdq,pclmul,sse4.2")))
+static uint32_t crc32c_clmul_copy(uint32_t crc, void* dst, const void* src, size_t size)
+{
+    return crc32c_clmul_body(crc, dst, src, size, 1);
+}
+#endif
+
+/* Copy then checksum, when the implementation cannot do both at once */
+static uint32_t crc32c_copy(uint32_t crc, void* dst, const void* src, size_t size)
+{
+    memcpy(dst, src, size);
+    return crc_fn(crc, dst, size);
+}
+
+static void crc32c_init(void)
+{
+    uint32_t n, crc;
+    int k;
+
+    for (n = 0; n < 256; n++) {
+        crc = n;
+        for (k = 0; k < 8; k++) crc = (crc & 1) ? (crc >> 1) ^ POLY : crc >> 1;
+        crc_table[0][n] = crc;
+    }
+    for (n = 0; n < 256; n++) {
+        crc = crc_table[0][n];
+        for (k = 1; k < 8; k++) {
+            crc = crc_table[0][crc & 0xff] ^ (crc >> 8);
+            crc_table[k][n] = crc;
+        }
+    }
+    for (k = 0; k < TIERS; k++) crc32c_zeros(crc_zeros[k], SHORT >> k);
+    for (k = 1; k < 7; k++) crc32c_fold_constants(crc_fold[k], k * 64 * 8);
+    for (k = 0; k < 3; k++) crc32c_fold_constants(crc_lanes[k], (3 - k) * 16 * 8);
+
+    crc_fn = mictcp_crc32c_sw;
+    crc_copy_fn = crc32c_copy;
+    crc_name = "slice-by-8";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_fn = crc32c_hw;
+        crc_name = "sse4.2";
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")
+        && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq")) {
+        crc_fn = crc32c_clmul;
+        crc_copy_fn = crc32c_clmul_copy;
+        crc_name = "vpclmulqdq";
+    }
+#endif
+}
+
+/***********************
+ * Public entry points *
+ ***********************/
+
+uint32_t mictcp_crc32c_sw(uint32_t crc, const void* data, size_t size)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc32c_sw_raw(crc ^ 0xffffffff, data, size) ^ 0xffffffff;
+}
+
+uint32_t mictcp_crc32c(uint32_t crc, const void* data, size_t size)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_fn(crc, data, size);
+}
+
+uint32_t mictcp_crc32c_copy(uint32_t crc, void* dst, const void* src, size_t size)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_copy_fn(crc, dst, src, size);
+}
+
+const char* mictcp_crc32c_impl(void)
+{
+    pthread_once(&crc_once, crc32c_init);
+    return crc_name;
+}
@@ -0,0 +1,98 @@
+#include <api/mictcp_hist.h>
+#include <string.h>
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+/*******************
+ * Local functions *
+ *******************/
+
+static unsigned int bucket_of(unsigned long value)
+{
+    if (value >> MICTCP_HIST_MAX_BITS) value = (1UL << MICTCP_HIST_MAX_BITS) - 1;
+    if (value < (1UL << MICTCP_HIST_SUB_BITS)) return (unsigned int) value;
+
+    /* Power of two, then linear position inside it */
+    const unsigned int msb = 63 - __builtin_clzl(value);
+    const unsigned int shift = msb - MICTCP_HIST_SUB_BITS + 1;
+    return shift * MICTCP_HIST_HALF + (unsigned int)(value >> shift);
+}
+
+static unsigned long bucket_low(unsigned int index)
+{
+    if (index < (1U << MICTCP_HIST_SUB_BITS)) return index;
+    const unsigned int shift = index / MICTCP_HIST_HALF - 1;
+    return (unsigned long)(index - shift * MICTCP_HIST_HALF) << shift;
+}
+
+static unsigned long bucket_high(unsigned int index)
+{
+    if (index < (1U << MICTCP_HIST_SUB_BITS)) return index;
+    const unsigned int shift = index / MICTCP_HIST_HALF - 1;
+    return bucket_low(index) + (1UL << shift) - 1;
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+void mictcp_hist_record(mictcp_hist* hist, unsigned long value)
+{
+    __atomic_fetch_add(&hist->counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+}
+
+void mictcp_hist_reset(mictcp_hist* hist)
+{
+    memset(hist, 0, sizeof(mictcp_hist));
+}
+
+void mictcp_hist_merge(mictcp_hist* dst, const mictcp_hist* src)
+{
+    unsigned int k;
+
+    for (k = 0; k < MICTCP_HIST_BUCKETS; k++) {
+        const unsigned long count = LOAD(src->counts[k]);
+        if (count) dst->counts[k] += count;
+    }
+    dst->sum += LOAD(src->sum);
+    dst->total += LOAD(src->total);
+}
+
+unsigned long mictcp_hist_percentile(const mictcp_hist* hist, double p)
+{
+    unsigned long total = 0, seen = 0;
+    unsigned int k;
+
+    /* The total is recomputed from the buckets, which may be ahead of
+       hist->total while values are being recorded */
+    for (k = 0; k < MICTCP_HIST_BUCKETS; k++) total += LOAD(hist->counts[k]);
+    if (total == 0) return 0;
+
+    unsigned long rank = (unsigned long)(p * (double) total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    for (k = 0; k < MICTCP_HIST_BUCKETS; k++) {
+        seen += LOAD(hist->counts[k]);
+        if (seen >= rank) return bucket_high(k);
+    }
+    return bucket_high(MICTCP_HIST_BUCKETS - 1);
+}
+
+unsigned long mictcp_hist_mean(const mictcp_hist* hist)
+{
+    const unsigned long total = LOAD(hist->total);
+    return total > 0 ? LOAD(hist->sum) / total : 0;
+}
+
+void mictcp_hist_export(const mictcp_hist* hist, FILE* out)
+{
+    unsigned int k;
+
+    for (k = 0; k < MICTCP_HIST_BUCKETS; k++) {
+        const unsigned long count = LOAD(hist->counts[k]);
+        if (count) fprintf(out, "%lu,%lu,%lu\n", bucket_low(k), bucket_high(k), count);
+    }
+}
@@ -0,0 +1,121 @@
+#include <api/mictcp_impair.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*******************
+ * Local functions *
+ *******************/
+
+/* splitmix64, to expand a seed into the xoshiro state */
+static uint64_t splitmix64(uint64_t* state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Percentage, with an optional % sign */
+static int parse_probability(const char* s, char** end, double* value)
+{
+    *value = strtod(s, end) / 100.0;
+    if (*end == s || *value < 0.0 || *value > 1.0) return -1;
+    if (**end == '%') (*end)++;
+    return 0;
+}
+
+/* Time in ms, or in us with the us suffix */
+static int parse_time(const char* s, char** end, unsigned long* value)
+{
+    double t = strtod(s, end);
+    if (*end == s || t < 0.0) return -1;
+    if (strncmp(*end, "us", 2) == 0) {
+        *end += 2;
+    } else {
+        if (strncmp(*end, "ms", 2) == 0) *end += 2;
+        t *= 1000.0;
+    }
+    *value = (unsigned long) t;
+    return 0;
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+void mictcp_rng_seed(mictcp_rng* rng, uint64_t seed)
+{
+    int k;
+    for (k = 0; k < 4; k++) rng->s[k] = splitmix64(&seed);
+}
+
+int mictcp_impair_apply(const mictcp_impair* impair, int* bad, mictcp_rng* rng,
+                        unsigned long delays[MICTCP_IMPAIR_COPIES])
+{
+    int copies = 1, k;
+
+    /* Gilbert-Elliott two-state loss */
+    if (*bad) {
+        if (mictcp_rng_uniform(rng) < impair->burst_exit) *bad = 0;
+    } else if (impair->burst_enter > 0 && mictcp_rng_uniform(rng) < impair->burst_enter) {
+        *bad = 1;
+    }
+    const double loss = *bad ? impair->burst_loss : impair->loss;
+    if (loss > 0 && mictcp_rng_uniform(rng) < loss) return 0;
+
+    if (impair->duplicate > 0 && mictcp_rng_uniform(rng) < impair->duplicate) copies = 2;
+
+    for (k = 0; k < copies; k++) {
+        delays[k] = 0;
+        /* A reordered packet skips the delay and overtakes the queue */
+        if (impair->reorder > 0 && mictcp_rng_uniform(rng) < impair->reorder) continue;
+        delays[k] = impair->delay;
+        if (impair->jitter > 0) delays[k] += (unsigned long)(mictcp_rng_uniform(rng) * (double)(impair->jitter + 1));
+    }
+    return copies;
+}
+
+int mictcp_impair_delays(const mictcp_impair* impair)
+{
+    return impair->delay > 0 || impair->jitter > 0;
+}
+
+int mictcp_impair_parse(const char* spec, mictcp_impair* impair)
+{
+    mictcp_impair result = *impair;
+    const char* s = spec;
+    char* end;
+
+    while (*s != '\0') {
+        const char* eq = strchr(s, '=');
+        if (eq == NULL) return -1;
+        const size_t len = eq - s;
+        const char* value = eq + 1;
+
+        if (len == 4 && strncmp(s, "loss", len) == 0) {
+            if (parse_probability(value, &end, &result.loss) == -1) return -1;
+        } else if (len == 5 && strncmp(s, "burst", len) == 0) {
+            if (parse_probability(value, &end, &result.burst_enter) == -1 || *end != ':'
+                || parse_probability(end + 1, &end, &result.burst_exit) == -1) return -1;
+            result.burst_loss = 1.0;
+            if (*end == ':' && parse_probability(end + 1, &end, &result.burst_loss) == -1) return -1;
+        } else if (len == 5 && strncmp(s, "delay", len) == 0) {
+            if (parse_time(value, &end, &result.delay) == -1) return -1;
+        } else if (len == 6 && strncmp(s, "jitter", len) == 0) {
+            if (parse_time(value, &end, &result.jitter) == -1) return -1;
+        } else if (len == 3 && strncmp(s, "dup", len) == 0) {
+            if (parse_probability(value, &end, &result.duplicate) == -1) return -1;
+        } else if (len == 7 && strncmp(s, "reorder", len) == 0) {
+            if (parse_probability(value, &end, &result.reorder) == -1) return -1;
+        } else {
+            return -1;
+        }
+
+        if (*end == ',') end++;
+        else if (*end != '\0') return -1;
+        s = end;
+    }
+
+    *impair = result;
+    return 0;
+}
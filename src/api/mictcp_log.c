@@ -0,0 +1,220 @@
+#include <mictcp.h>
+#include <api/mictcp_log.h>
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define QUEUE_MASK (MICTCP_LOG_QUEUE - 1)
+
+/* Bounded multi-producer queue (Vyukov): a slot is free for the producer
+   at position pos when its sequence is pos, and ready for the consumer
+   when it is pos + 1 */
+typedef struct log_slot
+{
+    unsigned long seq;
+    char text[MICTCP_LOG_LINE];
+} log_slot;
+
+/*****************
+ * Log Variables *
+ *****************/
+#if defined(MICTCP_DEBUG_FUNCTIONS) || defined(MICTCP_DEBUG_RELIABILITY) || defined(MICTCP_DEBUG_RELIABILITY_DEFINITION) \
+    || defined(MICTCP_DEBUG_LOSS) || defined(MICTCP_DEBUG_REJECTED) || defined(MICTCP_DEBUG_CONNECTION)
+int mictcp_log_level = MICTCP_LOG_DEBUG;
+#else
+int mictcp_log_level = MICTCP_LOG_INFO;
+#endif
+
+static log_slot queue[MICTCP_LOG_QUEUE];
+static unsigned long enqueue_pos = 0, dequeue_pos = 0;
+static unsigned long dropped = 0;
+static FILE* output = NULL;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t writer_sem;
+static int writer_sleeping = 0;
+
+/*******************
+ * Local functions *
+ *******************/
+
+static void enqueue(const char* format, va_list args, const char* suffix)
+{
+    unsigned long pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    log_slot* slot;
+
+    while (1) {
+        slot = &queue[pos & QUEUE_MASK];
+        const long diff = (long) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long) pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        } else if (diff < 0) {
+            /* Queue full: the writer cannot keep up */
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            return;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    int size = vsnprintf(slot->text, MICTCP_LOG_LINE, format, args);
+    if (size < 0) size = 0;
+    if (size >= MICTCP_LOG_LINE) size = MICTCP_LOG_LINE - 1;
+    if (suffix != NULL) snprintf(slot->text + size, MICTCP_LOG_LINE - size, "%s", suffix);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /* The writer polls the queue; it is only woken up early when the
+       queue fills up, so that most messages cost no system call */
+    if (pos - __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED) >= MICTCP_LOG_QUEUE / 2
+        && __atomic_load_n(&writer_sleeping, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST)) {
+        sem_post(&writer_sem);
+    }
+}
+
+/* Writes out the queue, returns the number of messages */
+static int drain(void)
+{
+    int count = 0;
+
+    pthread_mutex_lock(&drain_lock);
+    while (1) {
+        log_slot* slot = &queue[dequeue_pos & QUEUE_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != dequeue_pos + 1) break;
+        fputs(slot->text, output);
+        fputc('\n', output);
+        __atomic_store_n(&slot->seq, dequeue_pos + MICTCP_LOG_QUEUE, __ATOMIC_RELEASE);
+        dequeue_pos++;
+        count++;
+    }
+    const unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost > 0) fprintf(output, "[MICTCP-LOG] %lu messages perdus (file pleine)\n", lost);
+    if (count > 0 || lost > 0) fflush(output);
+    pthread_mutex_unlock(&drain_lock);
+
+    return count;
+}
+
+static int queue_empty(void)
+{
+    const unsigned long pos = __atomic_load_n(&dequeue_pos, __ATOMIC_RELAXED);
+    return __atomic_load_n(&queue[pos & QUEUE_MASK].seq, __ATOMIC_ACQUIRE) != pos + 1;
+}
+
+static void* writer(void* arg)
+{
+    struct timespec ts;
+
+    while (1) {
+        if (drain() > 0) continue;
+
+        /* Announce the sleep, then check again so no message is missed */
+        __atomic_store_n(&writer_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!queue_empty()) {
+            __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += MICTCP_LOG_PERIOD * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(&writer_sem, &ts) == -1 && errno == EINTR);
+        __atomic_store_n(&writer_sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+    return NULL;
+}
+
+static void log_init(void)
+{
+    pthread_t th;
+    unsigned long k;
+
+    for (k = 0; k < MICTCP_LOG_QUEUE; k++) queue[k].seq = k;
+    if (output == NULL) output = stderr;
+    sem_init(&writer_sem, 0, 0);
+    if (pthread_create(&th, NULL, writer, NULL) == 0) pthread_detach(th);
+    atexit(mictcp_log_flush);
+}
+
+static unsigned long now_sec(void)
+{
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return ts.tv_sec;
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+void mictcp_log_write(mictcp_log_site* site, int level, const char* format, ...)
+{
+    va_list args;
+    char suffix[64];
+    const char* extra = NULL;
+
+    pthread_once(&log_once, log_init);
+
+    /* A new second opens a new budget, and reports what was suppressed */
+    const unsigned long now = now_sec();
+    unsigned long window = __atomic_load_n(&site->window, __ATOMIC_RELAXED);
+    if (window != now && __atomic_compare_exchange_n(&site->window, &window, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+        const unsigned long suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+        if (suppressed > 0) {
+            snprintf(suffix, sizeof(suffix), " (+%lu messages similaires supprimés)", suppressed);
+            extra = suffix;
+        }
+    }
+    if (__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED) >= MICTCP_LOG_RATE) {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    va_start(args, format);
+    enqueue(format, args, extra);
+    va_end(args);
+}
+
+void mictcp_log_set_level(int level)
+{
+    __atomic_store_n(&mictcp_log_level, level, __ATOMIC_RELAXED);
+}
+
+int mictcp_log_parse_level(const char* name)
+{
+    static const char* names[] = { "error", "warn", "info", "debug" };
+    char* end;
+    int k;
+
+    for (k = 0; k <= MICTCP_LOG_DEBUG; k++) {
+        if (strcasecmp(name, names[k]) == 0) return k;
+    }
+    k = (int) strtol(name, &end, 10);
+    return (end != name && *end == '\0' && k >= 0) ? k : -1;
+}
+
+void mictcp_log_set_output(FILE* out)
+{
+    pthread_mutex_lock(&drain_lock);
+    output = out;
+    pthread_mutex_unlock(&drain_lock);
+}
+
+void mictcp_log_flush(void)
+{
+    pthread_once(&log_once, log_init);
+    drain();
+}
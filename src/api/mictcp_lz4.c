@@ -0,0 +1,225 @@
+#include <api/mictcp_lz4.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_LOG 12
+#define MINMATCH 4
+#define LAST_LITERALS 5     /* the block ends with at least 5 literals */
+#define MFLIMIT 12          /* the last match starts at least 12 bytes before the end */
+#define SKIP_TRIGGER 6      /* misses before the search step grows */
+#define PROBE_SAMPLES 256
+
+static pthread_once_t entropy_once = PTHREAD_ONCE_INIT;
+static float nlogn[PROBE_SAMPLES + 1];   /* n log2 n, nlogn[0] = 0 */
+
+/*******************
+ * Local functions *
+ *******************/
+
+static inline uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline unsigned int hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* Writes the 255-byte continuation of a length above 15 */
+static inline uint8_t* put_length(uint8_t* op, int length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+/* Reads the continuation of a length field, -1 if the block ends first */
+static inline int get_length(const uint8_t** ip, const uint8_t* end)
+{
+    int length = 0;
+    uint8_t b;
+    do {
+        if (*ip >= end) return -1;
+        b = *(*ip)++;
+        length += b;
+    } while (b == 255);
+    return length;
+}
+
+static void entropy_init(void)
+{
+    int n;
+    for (n = 1; n <= PROBE_SAMPLES; n++) nlogn[n] = (float)(n * log2(n));
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+int mictcp_lz4_compress(const void* src, int size, void* dst, int capacity)
+{
+    const uint8_t* const base = src;
+    const uint8_t* const end = base + size;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = dst;
+    uint8_t* const oend = op + capacity;
+
+    if (size < 0 || size > MICTCP_LZ4_MAX_BLOCK) return 0;
+
+    if (size > MFLIMIT) {
+        /* Positions fit in 16 bits, as do match offsets */
+        uint16_t table[1 << HASH_LOG];
+        const uint8_t* const mflimit = end - MFLIMIT;
+        const uint8_t* const matchlimit = end - LAST_LITERALS;
+        unsigned int misses = 0;
+
+        memset(table, 0, sizeof(table));
+        ip++;
+        while (ip <= mflimit) {
+            const unsigned int h = hash(read32(ip));
+            const uint8_t* ref = base + table[h];
+            table[h] = (uint16_t)(ip - base);
+            if (ref >= ip || read32(ref) != read32(ip)) {
+                /* Incompressible data is skipped faster and faster */
+                ip += 1 + (misses++ >> SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            /* Extend the match backwards, then forwards */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* m = ip + MINMATCH;
+            const uint8_t* r = ref + MINMATCH;
+            while (m < matchlimit && *m == *r) {
+                m++;
+                r++;
+            }
+
+            const int literals = (int)(ip - anchor);
+            const int match = (int)(m - ip) - MINMATCH;
+            if (oend - op < 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1) return 0;
+
+            uint8_t* token = op++;
+            if (literals >= 15) {
+                *token = 15 << 4;
+                op = put_length(op, literals - 15);
+            } else {
+                *token = (uint8_t)(literals << 4);
+            }
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            const unsigned int offset = (unsigned int)(ip - ref);
+            *op++ = (uint8_t) offset;
+            *op++ = (uint8_t)(offset >> 8);
+            if (match >= 15) {
+                *token |= 15;
+                op = put_length(op, match - 15);
+            } else {
+                *token |= (uint8_t) match;
+            }
+
+            ip = anchor = m;
+            if (ip <= mflimit) table[hash(read32(ip - 2))] = (uint16_t)(ip - 2 - base);
+        }
+    }
+
+    /* Last literals */
+    const int literals = (int)(end - anchor);
+    if (oend - op < 1 + (literals >= 15 ? literals / 255 + 1 : 0) + literals) return 0;
+    if (literals >= 15) {
+        *op++ = 15 << 4;
+        op = put_length(op, literals - 15);
+    } else {
+        *op++ = (uint8_t)(literals << 4);
+    }
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (int)(op - (uint8_t*) dst);
+}
+
+int mictcp_lz4_decompress(const void* src, int size, void* dst, int capacity)
+{
+    const uint8_t* ip = src;
+    const uint8_t* const iend = ip + size;
+    uint8_t* const ostart = dst;
+    uint8_t* op = ostart;
+    uint8_t* const oend = op + capacity;
+
+    while (ip < iend) {
+        const uint8_t token = *ip++;
+
+        int literals = token >> 4;
+        if (literals == 15) {
+            const int more = get_length(&ip, iend);
+            if (more < 0) return -1;
+            literals += more;
+        }
+        if (literals > iend - ip || literals > oend - op) return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        /* The last sequence has no match */
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        const unsigned int offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (unsigned int)(op - ostart)) return -1;
+
+        int match = token & 15;
+        if (match == 15) {
+            const int more = get_length(&ip, iend);
+            if (more < 0) return -1;
+            match += more;
+        }
+        match += MINMATCH;
+        if (match > oend - op) return -1;
+
+        const uint8_t* ref = op - offset;
+        if (offset >= (unsigned int) match) {
+            memcpy(op, ref, match);
+            op += match;
+        } else {
+            /* Overlapping copy: repeats the last offset bytes */
+            while (match--) *op++ = *ref++;
+        }
+    }
+
+    return (int)(op - ostart);
+}
+
+double mictcp_lz4_entropy(const void* data, int size)
+{
+    const uint8_t* p = data;
+    uint16_t counts[256] = {0};
+    float sum = 0;
+    int k;
+
+    if (size <= 1) return 0;
+    pthread_once(&entropy_once, entropy_init);
+
+    /* Evenly spaced samples, so that a header does not decide alone.
+       H = log2(n) - sum(c log2 c) / n, the sum being updated per sample */
+    const int samples = size < PROBE_SAMPLES ? size : PROBE_SAMPLES;
+    const unsigned long step = ((unsigned long) size << 16) / samples;
+    unsigned long position = 0;
+    for (k = 0; k < samples; k++, position += step) {
+        const unsigned int c = counts[p[position >> 16]]++;
+        sum += nlogn[c + 1] - nlogn[c];
+    }
+    return 1.0 - sum / samples / log2(samples);
+}
@@ -0,0 +1,312 @@
+#include <api/mictcp_sim.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_ACTORS 32
+#define SIM_NEVER ULONG_MAX
+#define CLIENT_SIDE 0
+#define SERVER_SIDE 1
+
+typedef struct sim_packet
+{
+    struct sim_packet* next;
+    unsigned long due;  /* virtual delivery time (us) */
+    int size;
+    char data[];
+} sim_packet;
+
+typedef struct sim_actor
+{
+    int used;
+    unsigned long deadline; /* wake-up time while blocked */
+} sim_actor;
+
+typedef struct sim_link_state
+{
+    sim_packet* head;           /* in flight, sorted by delivery time */
+    unsigned long busy_until;   /* end of the current serialization */
+    int bad;                    /* burst state */
+    mictcp_rng rng;             /* one generator per link: draws do not depend
+                                   on how the two sides interleave */
+    mictcp_sim_stats stats;
+} sim_link_state;
+
+/*****************
+ * Sim Variables *
+ *****************/
+static int enabled = 0;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t sim_key;
+static unsigned long now = 0;
+static unsigned long long generation = 0;
+static int actors = 0, reserved = 0, blocked = 0, idle = 0;
+static sim_actor actor[SIM_ACTORS];
+static mictcp_sim_config config;
+static sim_link_state link_state[2];
+
+static __thread int self = -1;
+
+/*******************
+ * Local functions *
+ *******************/
+
+/* Every blocked actor becomes runnable */
+static void wake_all(void)
+{
+    generation++;
+    blocked = 0;
+    idle = 0;
+    pthread_cond_broadcast(&sim_cond);
+}
+
+/* Called when no actor can run: jump to the next event */
+static void advance(void)
+{
+    unsigned long next = SIM_NEVER;
+    sim_packet* p;
+    int k;
+
+    if (actors > 0) {
+        for (k = 0; k < 2; k++) {
+            for (p = link_state[k].head; p != NULL && p->due <= now; p = p->next);
+            if (p != NULL && p->due < next) next = p->due;
+        }
+        for (k = 0; k < SIM_ACTORS; k++) {
+            if (actor[k].used && actor[k].deadline > now && actor[k].deadline < next) next = actor[k].deadline;
+        }
+    }
+
+    if (next == SIM_NEVER) {
+        /* Nothing will ever happen again */
+        idle = 1;
+        pthread_cond_broadcast(&sim_cond);
+        return;
+    }
+
+    __atomic_store_n(&now, next, __ATOMIC_RELAXED);
+    wake_all();
+}
+
+/* Wait, as an actor, until something happens or deadline is reached */
+static void block(unsigned long deadline)
+{
+    const unsigned long long gen = generation;
+
+    actor[self].deadline = deadline;
+    blocked++;
+    if (blocked == actors) advance();
+
+    while (generation == gen) pthread_cond_wait(&sim_cond, &sim_lock);
+}
+
+static void detach(int slot)
+{
+    actor[slot].used = 0;
+    actors--;
+    if (blocked == actors) advance();
+}
+
+static void on_thread_exit(void* value)
+{
+    pthread_mutex_lock(&sim_lock);
+    detach((int)(intptr_t) value - 1);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+static void attach(void)
+{
+    int k;
+
+    if (self != -1) return;
+
+    for (k = 0; k < SIM_ACTORS && actor[k].used; k++);
+    if (k == SIM_ACTORS) {
+        fprintf(stderr, "[MICTCP-SIM] Too many threads\n");
+        abort();
+    }
+
+    actor[k].used = 1;
+    self = k;
+    if (reserved > 0) reserved--;
+    else actors++;
+    pthread_setspecific(sim_key, (void*)(intptr_t)(k + 1));
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+void mictcp_sim_enable(const mictcp_sim_config* cfg)
+{
+    pthread_mutex_lock(&sim_lock);
+    if (!enabled) pthread_key_create(&sim_key, on_thread_exit);
+    config = *cfg;
+    now = 0;
+    memset(link_state, 0, sizeof(link_state));
+    mictcp_rng_seed(&link_state[CLIENT_SIDE].rng, cfg->seed);
+    mictcp_rng_seed(&link_state[SERVER_SIDE].rng, cfg->seed ^ 0x5555555555555555ULL);
+    enabled = 1;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+int mictcp_sim_enabled(void)
+{
+    return enabled;
+}
+
+unsigned long mictcp_sim_now_usec(void)
+{
+    return __atomic_load_n(&now, __ATOMIC_RELAXED);
+}
+
+void mictcp_sim_reserve(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    actors++;
+    reserved++;
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_attach(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    attach();
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_detach(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    if (self != -1) {
+        pthread_setspecific(sim_key, NULL);
+        detach(self);
+        self = -1;
+    }
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_wait_idle(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    while (!idle) pthread_cond_wait(&sim_cond, &sim_lock);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+int mictcp_sim_send(int side, const char* data, int size)
+{
+    sim_link_state* link = &link_state[side];
+    const mictcp_sim_link* cfg = &config.link[side];
+    sim_packet *packet, **pos;
+    unsigned long delays[MICTCP_IMPAIR_COPIES], start;
+    int copies, k;
+
+    pthread_mutex_lock(&sim_lock);
+    attach();
+    link->stats.sent++;
+
+    /* Drop-tail at the bottleneck: the backlog is what remains to be serialized */
+    if (cfg->bandwidth > 0 && cfg->queue > 0 && link->busy_until > now
+        && (double)(link->busy_until - now) * (double) cfg->bandwidth / 1e6 + size > (double) cfg->queue) {
+        link->stats.dropped++;
+        pthread_mutex_unlock(&sim_lock);
+        return size;
+    }
+
+    copies = mictcp_impair_apply(&cfg->impair, &link->bad, &link->rng, delays);
+    if (copies == 0) {
+        link->stats.dropped++;
+        pthread_mutex_unlock(&sim_lock);
+        return size;
+    }
+
+    /* Serialization at the link rate, then propagation */
+    start = link->busy_until > now ? link->busy_until : now;
+    if (cfg->bandwidth > 0) start += (unsigned long)((double) size * 1e6 / (double) cfg->bandwidth);
+    link->busy_until = start;
+
+    for (k = 0; k < copies; k++) {
+        packet = malloc(sizeof(sim_packet) + size);
+        packet->due = start + delays[k];
+        packet->size = size;
+        memcpy(packet->data, data, size);
+
+        /* Packets due at the same time keep their sending order */
+        for (pos = &link->head; *pos != NULL && (*pos)->due <= packet->due; pos = &(*pos)->next);
+        packet->next = *pos;
+        *pos = packet;
+    }
+
+    wake_all();
+    pthread_mutex_unlock(&sim_lock);
+    return size;
+}
+
+int mictcp_sim_recv(int side, char* buffer, int size, unsigned long timeout)
+{
+    sim_link_state* link = &link_state[1 - side];
+    unsigned long deadline;
+    int result = -1;
+
+    pthread_mutex_lock(&sim_lock);
+    attach();
+
+    /* A zero timeout waits forever, as SO_RCVTIMEO does */
+    deadline = timeout > 0 ? now + timeout * 1000 : SIM_NEVER;
+
+    for (;;) {
+        sim_packet* packet = link->head;
+        if (packet != NULL && packet->due <= now) {
+            link->head = packet->next;
+            link->stats.delivered++;
+            result = packet->size < size ? packet->size : size;
+            memcpy(buffer, packet->data, result);
+            free(packet);
+            break;
+        }
+        if (now >= deadline) {
+            errno = EAGAIN;
+            break;
+        }
+        block(deadline);
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+    return result;
+}
+
+void mictcp_sim_wait(int (*ready)(void*), void* arg)
+{
+    pthread_mutex_lock(&sim_lock);
+    attach();
+    while (!ready(arg)) block(SIM_NEVER);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_notify(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    wake_all();
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_sleep_usec(unsigned long usec)
+{
+    pthread_mutex_lock(&sim_lock);
+    attach();
+    const unsigned long deadline = now + usec;
+    while (now < deadline) block(deadline);
+    pthread_mutex_unlock(&sim_lock);
+}
+
+void mictcp_sim_get_stats(int side, mictcp_sim_stats* stats)
+{
+    pthread_mutex_lock(&sim_lock);
+    *stats = link_state[side].stats;
+    pthread_mutex_unlock(&sim_lock);
+}
@@ -0,0 +1,57 @@
+#include <api/mictcp_siphash.h>
+
+#define ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+/* Little-endian load, whatever the host */
+static uint64_t load64(const unsigned char* p, size_t size)
+{
+    uint64_t v = 0;
+    size_t k;
+    for (k = 0; k < size; k++) v |= (uint64_t) p[k] << (8 * k);
+    return v;
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+uint64_t mictcp_siphash(const unsigned char key[16], const void* data, size_t size)
+{
+    const unsigned char* p = data;
+    const uint64_t k0 = load64(key, 8), k1 = load64(key + 8, 8);
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    size_t left = size;
+
+    for (; left >= 8; left -= 8, p += 8) {
+        const uint64_t m = load64(p, 8);
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    /* Last block: remaining bytes, and the length in the top byte */
+    const uint64_t b = load64(p, left) | (uint64_t) size << 56;
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
@@ -0,0 +1,224 @@
+#include <api/mictcp_trace.h>
+#include <api/mictcp_clock.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct trace_ring
+{
+    uint64_t head;      /* events ever recorded, published with release */
+    mictcp_trace_event events[MICTCP_TRACE_RING];
+} trace_ring;
+
+/*******************
+ * Trace Variables *
+ *******************/
+int mictcp_trace_enabled = 0;
+__thread unsigned long mictcp_trace_clock = 0;
+
+static trace_ring* rings[MICTCP_TRACE_THREADS];
+static unsigned int ring_count = 0;
+static __thread trace_ring* ring = NULL;
+static __thread int ring_failed = 0;
+
+/* Clock of the stamps */
+static unsigned long (*trace_now)(void) = mictcp_clock_usec;
+
+static sem_t dump_sem;
+static const char* dump_path = NULL;
+
+/*******************
+ * Local functions *
+ *******************/
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static trace_ring* thread_ring(void)
+{
+    if (ring == NULL && !ring_failed) {
+        const unsigned int k = __atomic_fetch_add(&ring_count, 1, __ATOMIC_RELAXED);
+        if (k >= MICTCP_TRACE_THREADS || (ring = calloc(1, sizeof(trace_ring))) == NULL) {
+            ring_failed = 1;
+            return NULL;
+        }
+        __atomic_store_n(&rings[k], ring, __ATOMIC_RELEASE);
+    }
+    return ring;
+}
+
+static void put_block(FILE* f, uint32_t type, const void* body, uint32_t size)
+{
+    static const char padding[4] = {0};
+    const uint32_t padded = (size + 3) & ~3U;
+    const uint32_t total = 12 + padded;
+
+    fwrite(&type, 4, 1, f);
+    fwrite(&total, 4, 1, f);
+    fwrite(body, 1, size, f);
+    fwrite(padding, 1, padded - size, f);
+    fwrite(&total, 4, 1, f);
+}
+
+static void* dump_thread(void* arg)
+{
+    while (1) {
+        if (sem_wait(&dump_sem) == 0) mictcp_trace_dump(dump_path);
+    }
+    return NULL;
+}
+
+static void on_signal(int signum)
+{
+    sem_post(&dump_sem);
+}
+
+/********************
+ * Public functions *
+ ********************/
+
+void mictcp_trace_record(int type, int socket, const mic_tcp_header* header, int size, unsigned int arg)
+{
+    trace_ring* r = ring;
+    if (__builtin_expect(r == NULL, 0) && (r = thread_ring()) == NULL) return;
+
+    /* Built in registers and stored at once; the thread is set in exports */
+    mictcp_trace_event e = {
+        .usec = mictcp_trace_clock,
+        .type = type, .socket = socket, .size = size, .arg = arg
+    };
+    if (__builtin_expect(e.usec == 0, 0)) e.usec = mictcp_trace_clock = trace_now();
+    if (header != NULL) {
+        e.flags = header->syn | header->ack << 1 | header->fin << 2 | header->more << 3 | header->batch << 4
+                | header->compressed << 5;
+        e.seq = header->seq_num;
+        e.ack = header->ack_num;
+        e.stream = header->stream;
+    }
+
+    const uint64_t head = r->head;
+    r->events[head & (MICTCP_TRACE_RING - 1)] = e;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void mictcp_trace_enable(int enabled)
+{
+    __atomic_store_n(&mictcp_trace_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+void mictcp_trace_set_clock(unsigned long (*now)(void))
+{
+    trace_now = now;
+}
+
+int mictcp_trace_dump(const char* path)
+{
+    mictcp_trace_event *events, *merged;
+    size_t start[MICTCP_TRACE_THREADS + 1], next[MICTCP_TRACE_THREADS];
+    unsigned int k, threads;
+    size_t count = 0, i;
+
+    threads = __atomic_load_n(&ring_count, __ATOMIC_RELAXED);
+    if (threads > MICTCP_TRACE_THREADS) threads = MICTCP_TRACE_THREADS;
+    events = malloc(2 * ((size_t) threads * MICTCP_TRACE_RING * sizeof(mictcp_trace_event) + 1));
+    if (events == NULL) return -1;
+    merged = events + (size_t) threads * MICTCP_TRACE_RING;
+
+    /* Snapshot of the rings, events being overwritten meanwhile are skipped */
+    for (k = 0; k < threads; k++) {
+        start[k] = count;
+        trace_ring* r = __atomic_load_n(&rings[k], __ATOMIC_ACQUIRE);
+        if (r == NULL) continue;
+        const uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        uint64_t n = head < MICTCP_TRACE_RING ? head : MICTCP_TRACE_RING;
+        uint64_t j;
+        for (j = head - n; j < head; j++) {
+            events[count] = r->events[j & (MICTCP_TRACE_RING - 1)];
+            events[count++].thread = k;
+        }
+        /* Events overwritten while being copied are dropped */
+        const uint64_t written = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - head;
+        if (written > MICTCP_TRACE_RING - n) {
+            uint64_t lost = written - (MICTCP_TRACE_RING - n);
+            if (lost > n) lost = n;
+            memmove(&events[count - n], &events[count - n + lost], (n - lost) * sizeof(mictcp_trace_event));
+            count -= lost;
+        }
+    }
+    start[threads] = count;
+
+    /* Merge in time order, keeping the order of each thread for events
+       stamped with the same time */
+    for (k = 0; k < threads; k++) next[k] = start[k];
+    for (i = 0; i < count; i++) {
+        unsigned int best = threads;
+        for (k = 0; k < threads; k++) {
+            if (next[k] < start[k + 1] && (best == threads || events[next[k]].usec < events[next[best]].usec)) best = k;
+        }
+        merged[i] = events[next[best]++];
+    }
+
+    /* Events are placed back from now, on the clock that stamped them */
+    const unsigned long clock_now = trace_now();
+    const uint64_t real_now = clock_ns(CLOCK_REALTIME);
+
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        free(events);
+        return -1;
+    }
+
+    /* Section header: byte-order magic, version 1.0, unknown length */
+    const struct { uint32_t magic; uint16_t major, minor; int64_t length; } __attribute__((packed))
+        shb = { 0x1a2b3c4d, 1, 0, -1 };
+    put_block(f, 0x0a0d0d0a, &shb, sizeof(shb));
+
+    /* Interface: custom link type, nanosecond timestamps (if_tsresol = 9) */
+    const struct { uint16_t linktype, reserved; uint32_t snaplen; uint16_t code, len; uint8_t tsresol, pad[3];
+                   uint32_t end; } __attribute__((packed))
+        idb = { MICTCP_TRACE_LINKTYPE, 0, sizeof(mictcp_trace_event), 9, 1, 9, {0}, 0 };
+    put_block(f, 1, &idb, sizeof(idb));
+
+    for (i = 0; i < count; i++) {
+        struct { uint32_t interface, ts_high, ts_low, captured, original; mictcp_trace_event event; }
+            __attribute__((packed)) epb;
+        const uint64_t ns = real_now - (int64_t)(clock_now - merged[i].usec) * 1000;
+        epb.interface = 0;
+        epb.ts_high = ns >> 32;
+        epb.ts_low = (uint32_t) ns;
+        epb.captured = epb.original = sizeof(mictcp_trace_event);
+        epb.event = merged[i];
+        put_block(f, 6, &epb, sizeof(epb));
+    }
+
+    fclose(f);
+    free(events);
+    return (int) count;
+}
+
+int mictcp_trace_dump_on_signal(int signum, const char* path)
+{
+    struct sigaction sa;
+    pthread_t th;
+
+    if (dump_path == NULL) {
+        if (sem_init(&dump_sem, 0, 0) == -1 || pthread_create(&th, NULL, dump_thread, NULL) != 0) return -1;
+        pthread_detach(th);
+    }
+    dump_path = path;
+
+    /* The handler only wakes the dump thread: sem_post is async-signal-safe */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(signum, &sa, NULL);
+}
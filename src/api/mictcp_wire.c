@@ -0,0 +1,26 @@
+#include <api/mictcp_wire.h>
+
+const unsigned char* mictcp_wire_get_option(const unsigned char* buf, int hlen, unsigned char type, int* value_size)
+{
+    int off = MICTCP_WIRE_HEADER_SIZE;
+
+    while (off < hlen)
+    {
+        const unsigned char t = buf[off];
+
+        if (t == MICTCP_OPT_END) break;
+        if (t == MICTCP_OPT_NOP) { off++; continue; }
+
+        /* Truncated or zero-length option: stop parsing */
+        if (off + 2 > hlen || buf[off + 1] < 2 || off + buf[off + 1] > hlen) break;
+
+        if (t == type)
+        {
+            if (value_size != NULL) *value_size = buf[off + 1] - 2;
+            return buf + off + 2;
+        }
+        off += buf[off + 1];
+    }
+
+    return NULL;
+}
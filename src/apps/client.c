@@ -23,6 +23,9 @@ int main()
         printf("[TSOCK] Creation du socket MICTCP: OK\n");
     }
 
+    /* Les lignes envoyees coup sur coup partagent un meme PDU */
+    mic_tcp_setsockopt(sockfd, OPT_CORK, 1);
+
     if (mic_tcp_connect(sockfd, addr) == -1)
     {
         printf("[TSOCK] Erreur a la connexion du socket MICTCP!\n");
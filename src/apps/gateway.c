@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     // sendmmsg
 #include <errno.h>
 #include <mictcp.h>
 #include <netdb.h>
@@ -5,11 +6,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 #include <limits.h>
+#include <pthread.h>
 
 //
 // Déclaration des types, constantes et macros
@@ -19,6 +24,15 @@
 #define MAX_UDP_SEGMENT_SIZE 1480
 #define MICTCP_PORT 1337
 #define VIDEO_FILE "../video/video.bin"
+#define RTP_HEADER_SIZE 12                  // timestamp (2 x 4 octets) + taille (4 octets)
+#define READAHEAD_SIZE (4 * 1024 * 1024)    // octets demandés en avance au noyau
+#define LAG_REPORT_PERIOD 10                // secondes entre deux rapports de retard
+#define GATEWAY_BATCH 64                    // paquets lus ou envoyés au plus par appel
+#define RTP_CLOCK_RATE 90000                // horloge RTP de la vidéo (Hz)
+#define JITTER_SLOTS 1024                   // paquets retenus au plus par le tampon de gigue
+#define JITTER_MIN_DELAY 5                  // profondeur minimale du tampon (ms)
+#define JITTER_MAX_DELAY 500                // profondeur maximale par défaut (ms)
+#define JITTER_FACTOR 4                     // profondeur visée, en multiple de la gigue observée
 
 /**
  * Macro utilisée pour afficher le message d'erreur msg passé en paramètre
@@ -56,6 +70,84 @@ enum gateway_protocol {
     PROTO_MICTCP
 };
 
+/**
+ * Enregistrement rtp du fichier vidéo
+ */
+struct rtp_record {
+    struct timespec timestamp;
+    const char *payload;        // pointe dans le fichier projeté
+    int size;
+};
+
+/**
+ * Fichier vidéo projeté en mémoire et son index
+ */
+struct video {
+    char *data;
+    size_t size;
+    struct rtp_record *records;
+    size_t count;
+    size_t readahead;           // fin de la zone déjà demandée au noyau
+};
+
+/**
+ * Écart entre l'envoi réel des paquets et leur échéance
+ */
+struct pacing_lag {
+    long long max;              // ns
+    long long sum;              // ns
+    unsigned long count;
+    unsigned long batches;      // réveils du thread d'envoi
+    time_t next_report;
+};
+
+/**
+ * Paquet retenu par le tampon de gigue
+ */
+struct jitter_packet {
+    long long media;            // horodatage RTP étendu, converti en ns
+    int size;
+    char data[MAX_UDP_SEGMENT_SIZE];
+};
+
+/**
+ * Tampon de gigue : les paquets sont rejoués à l'écart de leurs horodatages
+ * RTP, décalés d'une profondeur qui suit la gigue observée (RFC 3550)
+ */
+struct jitter_buffer {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct jitter_packet slots[JITTER_SLOTS];
+    struct jitter_packet *free[JITTER_SLOTS];
+    struct jitter_packet *queue[JITTER_SLOTS];  // triée par échéance
+    int free_count, count;
+    int closed;
+
+    long long max_delay;        // ns
+    long long delay;            // profondeur courante (ns)
+    long long jitter;           // gigue estimée (ns)
+    long long transit;          // plus petit écart réception - horodatage (ns)
+    long long last_transit;
+    unsigned long arrivals;
+    unsigned int last_rtp;      // horodatage RTP brut du dernier paquet reçu
+    long long ticks;            // horodatage RTP étendu sur 64 bits du dernier paquet reçu
+    long long played_media;     // horodatage du dernier paquet rejoué
+
+    int sockfd;                 // socket UDP du lecteur
+    struct sockaddr_in addr;
+
+    unsigned long played, late, dropped;
+    time_t next_report;
+};
+
+//
+// Déclaration des variables globales
+//
+
+static long batch_tick = 0;     // durée d'un regroupement d'envois (ns), 0 sans regroupement
+static long jitter_max = JITTER_MAX_DELAY;  // profondeur maximale du tampon de gigue (ms), 0 sans tampon
+static long pacing_rate = 0;    // débit lissé de l'émission MICTCP (ko/s), 0 sans lissage
+
 //
 // Déclaration des fonctions locales
 //
@@ -63,8 +155,20 @@ enum gateway_protocol {
 static void file_to_faketcp(char* filename, char *host, int port);
 static void file_to_mictcp(char* filename);
 static void mictcp_to_udp(char *host, int port);
-static int read_rtp_packet(FILE *fd, struct timespec *timestamp, char *buffer, int buffer_size);
+static void video_open(char *filename, struct video *video);
+static void video_prefetch(struct video *video, const struct rtp_record *record);
+static void video_close(struct video *video);
 static struct timespec tsSubtract(struct timespec time1, struct timespec time2);
+static long long ts_to_ns(struct timespec time);
+static struct timespec ns_to_ts(long long ns);
+static void lag_report(const struct pacing_lag *lag, const char *when);
+static long long now_ns(void);
+static void jitter_init(struct jitter_buffer *jb);
+static void jitter_push(struct jitter_buffer *jb, const char *data, int size);
+static void jitter_close(struct jitter_buffer *jb);
+static void *jitter_playout(void *arg);
+static void jitter_report(struct jitter_buffer *jb, const char *when);
+static void send_batch(int sockfd, struct sockaddr_in *addr, mic_tcp_payload *packets, int count);
 static void usage(void);
 
 //
@@ -77,8 +181,26 @@ int main(int argc, char** argv)
     enum gateway_function func = UND_FCT;
 
     int ch;
-    while ((ch = getopt(argc, argv, "t:sp")) != -1) {
+    while ((ch = getopt(argc, argv, "t:spb:j:r:")) != -1) {
         switch (ch) {
+        case 'j':
+            jitter_max = atol(optarg);
+            if (jitter_max < 0) {
+                usage();
+            }
+            break;
+        case 'r':
+            pacing_rate = atol(optarg);
+            if (pacing_rate < 0 || pacing_rate > INT_MAX / 1000) {
+                usage();
+            }
+            break;
+        case 'b':
+            batch_tick = atol(optarg) * 1000000L;
+            if (batch_tick < 0) {
+                usage();
+            }
+            break;
         case 't':
             if (strcmp(optarg, "mictcp") == 0) {
                 proto = PROTO_MICTCP;
@@ -140,7 +262,7 @@ int main(int argc, char** argv)
  */
 static void usage(void)
 {
-    printf("usage: gateway [-p|-s][-t tcp|mictcp] (<server>) <port>\n");
+    printf("usage: gateway [-p|-s][-t tcp|mictcp][-b batch_ms][-r rate_kBps][-j jitter_ms] (<server>) <port>\n");
     exit(EXIT_FAILURE);
 }
 
@@ -163,28 +285,28 @@ static void file_to_faketcp(char* filename, char *host, int port)
     ERROR_IF(host_info->h_addr == NULL, "gethostbyname no addr");
     memcpy(&(s_addr.sin_addr), host_info->h_addr, host_info->h_length);
 
-    /* Ouverture du fichier vidéo */
-    FILE *filefd = fopen(filename, "rb");
-    ERROR_IF(filefd == NULL, "Error fopen");
+    /* Projection du fichier vidéo */
+    struct video video;
+    video_open(filename, &video);
 
     uint count = 0;                             // compteur de paquets
-    struct timespec current_time, last_time;    // stockage des timestamps
-    char buffer[MAX_UDP_SEGMENT_SIZE];          // buffer de lecture/ecriture
+    struct timespec last_time;                  // stockage des timestamps
     last_time.tv_sec = -1;
     last_time.tv_nsec = LONG_MAX;
 
-    /* Lecture jusqu'à la fin du fichier vidéo */
-    while (!feof(filefd)) {
+    /* Parcours de l'index jusqu'à la fin du fichier vidéo */
+    const struct rtp_record *record;
+    for (record = video.records; record < video.records + video.count; record++) {
 
-        /* Lecture du paquet rtp */
-        int nb_read = read_rtp_packet(filefd, &current_time, buffer, MAX_UDP_SEGMENT_SIZE);
+        /* Pages des prochains paquets demandées à l'avance */
+        video_prefetch(&video, record);
 
-        /* Attente avant la prochaine lecture */
-        struct timespec delay = tsSubtract(current_time, last_time);
+        /* Attente avant le prochain envoi */
+        struct timespec delay = tsSubtract(record->timestamp, last_time);
         nanosleep(&delay, NULL);
 
         /* Mise à jour du timestamp */
-        last_time = current_time;
+        last_time = record->timestamp;
 
         if (ENABLE_TCP_LOSS) {
             /* On émule les pertes de paquets en délayant l'envoi de 2 secondes */
@@ -195,18 +317,23 @@ static void file_to_faketcp(char* filename, char *host, int port)
             }
         }
 
-        /* Envoi du paquet rtp via faketcp */
-        int nb_sent = sendto(sockfd, buffer, nb_read, 0, (struct sockaddr*)&s_addr, sizeof(s_addr));
+        /* Envoi du paquet rtp via faketcp, directement depuis le fichier projeté */
+        int nb_sent = sendto(sockfd, record->payload, record->size, 0, (struct sockaddr*)&s_addr, sizeof(s_addr));
         ERROR_IF(nb_sent == -1, "Error sendto");
     }
 
     /* Fermeture du socket et du fichier */
     close(sockfd);
-    fclose(filefd);
+    video_close(&video);
 }
 
 /**
  * Function that reads a file and delivers to MICTCP.
+ * Each packet is due at (start + its offset in the video) on CLOCK_MONOTONIC,
+ * so the time spent in mic_tcp_send does not accumulate into the schedule.
+ * With -b, every packet due within the same tick is sent on a single wakeup.
+ * With -r, MICTCP spreads those packets at the given rate instead of sending
+ * them back to back.
  */
 static void file_to_mictcp(char* filename)
 {
@@ -216,6 +343,11 @@ static void file_to_mictcp(char* filename)
         printf("ERROR creating the MICTCP socket\n");
     }
 
+    /* Lissage de l'émission à débit fixe */
+    if (pacing_rate > 0 && mic_tcp_setsockopt(sockfd, OPT_PACING_RATE, (int) pacing_rate * 1000) == -1) {
+        printf("ERROR setting the MICTCP pacing rate\n");
+    }
+
     /* On effectue la connexion */
     mic_tcp_sock_addr dest_addr;
     dest_addr.ip_addr = "localhost";
@@ -225,40 +357,62 @@ static void file_to_mictcp(char* filename)
         printf("ERROR connecting the MICTCP socket\n");
     }
 
-    /* Ouverture du fichier vidéo */
-    FILE *filefd = fopen(filename, "rb");
-    ERROR_IF(filefd == NULL, "Error fopen");
-
-    struct timespec current_time, last_time;    // stockage des timestamps
-    char buffer[MAX_UDP_SEGMENT_SIZE];          // buffer de lecture/ecriture
-    last_time.tv_sec = -1;
-    last_time.tv_nsec = LONG_MAX;
-
-    /* Lecture jusqu'à la fin du fichier vidéo */
-    while (!feof(filefd)) {
-
-        /* Lecture du paquet rtp */
-        int nb_read = read_rtp_packet(filefd, &current_time, buffer, MAX_UDP_SEGMENT_SIZE);
-
-        /* Attente avant la prochaine lecture */
-        struct timespec delay = tsSubtract(current_time, last_time);
-        nanosleep(&delay, NULL);
+    /* Projection du fichier vidéo */
+    struct video video;
+    video_open(filename, &video);
+
+    /* Échéancier absolu : origine du temps réel et de la vidéo */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long long start = ts_to_ns(now);
+    const long long origin = video.count > 0 ? ts_to_ns(video.records[0].timestamp) : 0;
+    struct pacing_lag lag = { .next_report = now.tv_sec + LAG_REPORT_PERIOD };
+    long long batch_end = LLONG_MIN;
+
+    /* Parcours de l'index jusqu'à la fin du fichier vidéo */
+    const struct rtp_record *record;
+    for (record = video.records; record < video.records + video.count; record++) {
+
+        /* Pages des prochains paquets demandées à l'avance */
+        video_prefetch(&video, record);
+
+        /* Attente de l'échéance du paquet, sauf s'il appartient au regroupement en cours */
+        long long due = start + ts_to_ns(record->timestamp) - origin;
+        if (due < start) due = start;
+        if (due > batch_end) {
+            struct timespec deadline = ns_to_ts(due);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+            batch_end = due + batch_tick;
+            lag.batches++;
+        }
 
-        /* Mise à jour du timestamp */
-        last_time = current_time;
+        /* Retard sur l'échéancier (un paquet regroupé part en avance, sans retard) */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const long long late = ts_to_ns(now) - due;
+        if (late > 0) {
+            lag.sum += late;
+            if (late > lag.max) lag.max = late;
+        }
+        lag.count++;
+        if (now.tv_sec >= lag.next_report) {
+            lag_report(&lag, "en cours");
+            lag.next_report = now.tv_sec + LAG_REPORT_PERIOD;
+        }
 
-        /* Envoi du paquet rtp via mictcp */
-        int nb_sent = mic_tcp_send(sockfd, buffer, nb_read);
+        /* Envoi du paquet rtp via mictcp, sans copie : mic_tcp_send ne modifie pas le message */
+        int nb_sent = mic_tcp_send(sockfd, (char *) record->payload, record->size);
         if (nb_sent < 0) {
             printf("ERROR on MICTCP send\n");
         }
     }
 
+    lag_report(&lag, "final");
+
     /* Fermeture du socket et du fichier */
     if (mic_tcp_close(sockfd) == -1) {
         printf("ERROR on MICTCP close\n");
     }
-    fclose(filefd);
+    video_close(&video);
 }
 
 /**
@@ -297,14 +451,31 @@ static void mictcp_to_udp(char *host, int port)
 
     /* Acceptation d'une demande de connexion */
     mic_tcp_sock_addr mt_remote_addr;
-    if (mic_tcp_accept(mictcp_sockfd, &mt_remote_addr) == -1) {
+    int mictcp_connfd = mic_tcp_accept(mictcp_sockfd, &mt_remote_addr);
+    if (mictcp_connfd == -1) {
         printf("ERROR on accept on the MICTCP socket\n");
     }
 
-    /* Lecture mictcp vers udp */
-    char buff[MAX_UDP_SEGMENT_SIZE];    // buffer de lecture/ecriture
+    /* Tampon de gigue, vidé par son propre thread au rythme des horodatages */
+    static struct jitter_buffer jb;
+    pthread_t playout;
+    if (jitter_max > 0) {
+        jitter_init(&jb);
+        jb.sockfd = udp_sockfd;
+        jb.addr = remote_s_addr;
+        ERROR_IF(pthread_create(&playout, NULL, jitter_playout, &jb) != 0, "Error pthread_create");
+    }
+
+    /* Lecture mictcp vers udp : tous les paquets en attente sont lus et envoyés ensemble */
+    static char buffs[GATEWAY_BATCH][MAX_UDP_SEGMENT_SIZE];    // buffers de lecture/ecriture
+    mic_tcp_payload packets[GATEWAY_BATCH];
     while (1) {
-        int nb_read = mic_tcp_recv(mictcp_sockfd, buff, MAX_UDP_SEGMENT_SIZE);
+        int k;
+        for (k = 0; k < GATEWAY_BATCH; k++) {
+            packets[k].data = buffs[k];
+            packets[k].size = MAX_UDP_SEGMENT_SIZE;
+        }
+        int nb_read = mic_tcp_recv_many(mictcp_connfd, packets, GATEWAY_BATCH);
         if (nb_read <= 0) {
             if (nb_read < 0) {
                 printf("ERROR on mic_recv on the MICTCP socket\n");
@@ -312,37 +483,102 @@ static void mictcp_to_udp(char *host, int port)
             break;      // Fin de la transmission
         }
 
-        int nb_sent = sendto(udp_sockfd, buff, nb_read, 0, (struct sockaddr*)&remote_s_addr, sizeof(remote_s_addr));
-        ERROR_IF(nb_sent == -1, "Error sendto");
+        if (jitter_max > 0) {
+            for (k = 0; k < nb_read; k++) {
+                jitter_push(&jb, packets[k].data, packets[k].size);
+            }
+        } else {
+            send_batch(udp_sockfd, &remote_s_addr, packets, nb_read);
+        }
+    }
+
+    /* Les paquets retenus sont rejoués avant la fermeture */
+    if (jitter_max > 0) {
+        jitter_close(&jb);
+        pthread_join(playout, NULL);
+        jitter_report(&jb, "final");
     }
 
     /* Fermeture des sockets */
-    if (mic_tcp_close(mictcp_sockfd) == -1) {
+    if (mic_tcp_close(mictcp_connfd) == -1 || mic_tcp_close(mictcp_sockfd) == -1) {
         printf("ERROR on MICTCP close\n");
     }
     close(udp_sockfd);
 }
 
 /**
- * Read one rtp packet from the video file in the buffer, as well as
- * the corresponding timestamp
- * Return the number of bytes read
+ * Map the whole video file in memory and index its rtp records
+ * (timestamp, payload pointer and size), so that sending never waits
+ * for a read. A truncated last record is ignored.
  */
-static int read_rtp_packet(FILE *fd, struct timespec *timestamp, char *buffer, int buffer_size)
+static void video_open(char *filename, struct video *video)
 {
-    /* Les champs du timestamp sont stockés sur 4 octets (héritage de la version 32 bits) */
-    timestamp->tv_sec = 0;
-    timestamp->tv_nsec = 0;
-    fread(&(timestamp->tv_sec), 1, 4, fd);
-    fread(&(timestamp->tv_nsec), 1, 4, fd);
-
-    /* Taille du packet rdp */
-    int packet_size = 0;
-    fread(&packet_size, 1, sizeof(int), fd);
-
-    /* Lecture du paquet rdp */
-    ERROR_IF(packet_size > buffer_size, "Buffer is too small to store the packet");
-    return fread(buffer, 1, packet_size, fd);
+    int fd = open(filename, O_RDONLY);
+    ERROR_IF(fd == -1, "Error open");
+    struct stat st;
+    ERROR_IF(fstat(fd, &st) == -1, "Error fstat");
+
+    memset(video, 0, sizeof(struct video));
+    video->size = st.st_size;
+    if (video->size > 0) {
+        video->data = mmap(NULL, video->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ERROR_IF(video->data == MAP_FAILED, "Error mmap");
+        /* Lecture séquentielle : lecture anticipée agressive, pages libérées derrière */
+        madvise(video->data, video->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* Construction de l'index, agrandi par doublement */
+    size_t capacity = 0, offset = 0;
+    while (offset + RTP_HEADER_SIZE <= video->size) {
+        const char *header = video->data + offset;
+
+        /* Les champs du timestamp sont stockés sur 4 octets (héritage de la version 32 bits) */
+        int32_t sec, nsec, packet_size;
+        memcpy(&sec, header, 4);
+        memcpy(&nsec, header + 4, 4);
+        memcpy(&packet_size, header + 8, 4);
+        ERROR_IF(packet_size < 0 || packet_size > MAX_UDP_SEGMENT_SIZE, "Buffer is too small to store the packet");
+        if (offset + RTP_HEADER_SIZE + packet_size > video->size) break;
+
+        if (video->count == capacity) {
+            capacity = capacity ? 2 * capacity : 1024;
+            video->records = realloc(video->records, capacity * sizeof(struct rtp_record));
+            ERROR_IF(video->records == NULL, "Error realloc");
+        }
+        struct rtp_record *record = &video->records[video->count++];
+        record->timestamp.tv_sec = (uint32_t) sec;
+        record->timestamp.tv_nsec = (uint32_t) nsec;
+        record->payload = header + RTP_HEADER_SIZE;
+        record->size = packet_size;
+        offset += RTP_HEADER_SIZE + packet_size;
+    }
+}
+
+/**
+ * Ask the kernel for the next READAHEAD_SIZE bytes once half of the
+ * previous request has been consumed
+ */
+static void video_prefetch(struct video *video, const struct rtp_record *record)
+{
+    const size_t position = record->payload - video->data;
+    if (position + READAHEAD_SIZE / 2 < video->readahead || video->readahead >= video->size) return;
+
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t start = position & ~((size_t) page - 1);
+    size_t end = position + READAHEAD_SIZE;
+    if (end > video->size) end = video->size;
+    madvise(video->data + start, end - start, MADV_WILLNEED);
+    video->readahead = end;
+}
+
+/**
+ * Unmap the video file and free its index
+ */
+static void video_close(struct video *video)
+{
+    if (video->data != NULL) munmap(video->data, video->size);
+    free(video->records);
 }
 
 /**
@@ -369,3 +605,246 @@ static struct timespec tsSubtract(struct timespec time1, struct timespec time2)
 
     return (result);
 }
+
+/**
+ * Convert a timespec to nanoseconds
+ */
+static long long ts_to_ns(struct timespec time)
+{
+    return (long long) time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/**
+ * Convert nanoseconds to a timespec
+ */
+static struct timespec ns_to_ts(long long ns)
+{
+    struct timespec result;
+    result.tv_sec = ns / 1000000000LL;
+    result.tv_nsec = ns % 1000000000LL;
+    return result;
+}
+
+/**
+ * Print how far the sending lags behind the schedule
+ */
+static void lag_report(const struct pacing_lag *lag, const char *when)
+{
+    printf("[GATEWAY] Retard sur l'échéancier (%s) : %lu paquets en %lu envois, moyen %.3f ms, max %.3f ms\n",
+           when, lag->count, lag->batches, lag->count > 0 ? lag->sum / 1e6 / lag->count : 0.0, lag->max / 1e6);
+    fflush(stdout);
+}
+
+/**
+ * Current CLOCK_MONOTONIC time in nanoseconds
+ */
+static long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ts_to_ns(now);
+}
+
+/**
+ * Initialize an empty jitter buffer
+ */
+static void jitter_init(struct jitter_buffer *jb)
+{
+    pthread_condattr_t attr;
+    int k;
+
+    memset(jb, 0, sizeof(struct jitter_buffer));
+    pthread_mutex_init(&jb->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&jb->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (k = 0; k < JITTER_SLOTS; k++) {
+        jb->free[k] = &jb->slots[k];
+    }
+    jb->free_count = JITTER_SLOTS;
+    jb->max_delay = jitter_max * 1000000LL;
+    jb->delay = JITTER_MIN_DELAY * 1000000LL;
+    jb->next_report = time(NULL) + LAG_REPORT_PERIOD;
+}
+
+/**
+ * Queue a received packet for playout. A packet older than one already
+ * played is dropped, since the player would get it out of order.
+ */
+static void jitter_push(struct jitter_buffer *jb, const char *data, int size)
+{
+    const long long now = now_ns();
+
+    pthread_mutex_lock(&jb->lock);
+
+    /* Horodatage RTP (octets 4 à 7), étendu sur 64 bits pour survivre au rebouclage.
+       Un paquet qui n'est pas du RTP v2 reprend l'horodatage du précédent. */
+    if (size >= 12 && (data[0] & 0xC0) == 0x80) {
+        uint32_t rtp;
+        memcpy(&rtp, data + 4, 4);
+        rtp = ntohl(rtp);
+        if (jb->arrivals > 0) {
+            jb->ticks += (int32_t)(rtp - jb->last_rtp);
+        }
+        jb->last_rtp = rtp;
+    }
+    const long long media = jb->ticks * 1000000000LL / RTP_CLOCK_RATE;
+
+    /* Gigue (RFC 3550) : variation lissée du temps de transit */
+    const long long transit = now - media;
+    if (jb->arrivals == 0) {
+        jb->transit = jb->last_transit = transit;
+    } else {
+        const long long d = transit - jb->last_transit;
+        jb->jitter += ((d < 0 ? -d : d) - jb->jitter) / 16;
+        jb->last_transit = transit;
+        if (transit < jb->transit) {
+            jb->transit = transit;
+        }
+    }
+
+    /* La profondeur monte aussitôt avec la gigue, et redescend lentement */
+    long long target = JITTER_FACTOR * jb->jitter;
+    if (target < JITTER_MIN_DELAY * 1000000LL) target = JITTER_MIN_DELAY * 1000000LL;
+    if (target > jb->max_delay) target = jb->max_delay;
+    if (target > jb->delay) {
+        jb->delay = target;
+    } else {
+        jb->delay -= (jb->delay - target) / 64;
+    }
+
+    if ((jb->played > 0 && media < jb->played_media) || jb->free_count == 0) {
+        jb->dropped++;
+    } else {
+        if (media + jb->transit + jb->delay < now) {
+            jb->late++;
+        }
+
+        struct jitter_packet *packet = jb->free[--jb->free_count];
+        packet->media = media;
+        packet->size = size;
+        memcpy(packet->data, data, size);
+
+        /* Insertion triée : les paquets arrivent presque toujours dans l'ordre */
+        int k = jb->count;
+        while (k > 0 && jb->queue[k - 1]->media > media) {
+            jb->queue[k] = jb->queue[k - 1];
+            k--;
+        }
+        jb->queue[k] = packet;
+        jb->count++;
+        pthread_cond_signal(&jb->cond);
+    }
+    jb->arrivals++;
+
+    pthread_mutex_unlock(&jb->lock);
+}
+
+/**
+ * Let the playout thread empty the buffer, then stop
+ */
+static void jitter_close(struct jitter_buffer *jb)
+{
+    pthread_mutex_lock(&jb->lock);
+    jb->closed = 1;
+    pthread_cond_signal(&jb->cond);
+    pthread_mutex_unlock(&jb->lock);
+}
+
+/**
+ * Playout thread: sends each packet to the player when
+ * (its media time + smallest transit + current depth) is reached.
+ * Packets due at the same time leave in a single batch.
+ */
+static void *jitter_playout(void *arg)
+{
+    struct jitter_buffer *jb = arg;
+    struct jitter_packet *due_packets[GATEWAY_BATCH];
+    mic_tcp_payload packets[GATEWAY_BATCH];
+    int k;
+
+    pthread_mutex_lock(&jb->lock);
+    while (jb->count > 0 || !jb->closed) {
+        if (jb->count == 0) {
+            pthread_cond_wait(&jb->cond, &jb->lock);
+            continue;
+        }
+
+        const long long due = jb->queue[0]->media + jb->transit + jb->delay;
+        const long long now = now_ns();
+        if (due > now) {
+            struct timespec deadline = ns_to_ts(due);
+            pthread_cond_timedwait(&jb->cond, &jb->lock, &deadline);
+            continue;
+        }
+
+        /* Tous les paquets échus partent ensemble */
+        int count = 0;
+        while (count < jb->count && count < GATEWAY_BATCH
+               && jb->queue[count]->media + jb->transit + jb->delay <= now) {
+            due_packets[count] = jb->queue[count];
+            packets[count].data = due_packets[count]->data;
+            packets[count].size = due_packets[count]->size;
+            count++;
+        }
+        jb->count -= count;
+        memmove(jb->queue, jb->queue + count, jb->count * sizeof(struct jitter_packet *));
+        jb->played_media = due_packets[count - 1]->media;
+        jb->played += count;
+
+        pthread_mutex_unlock(&jb->lock);
+        send_batch(jb->sockfd, &jb->addr, packets, count);
+        if (time(NULL) >= jb->next_report) {
+            jitter_report(jb, "en cours");
+            jb->next_report = time(NULL) + LAG_REPORT_PERIOD;
+        }
+        pthread_mutex_lock(&jb->lock);
+
+        for (k = 0; k < count; k++) {
+            jb->free[jb->free_count++] = due_packets[k];
+        }
+    }
+    pthread_mutex_unlock(&jb->lock);
+    return NULL;
+}
+
+/**
+ * Print the jitter buffer counters
+ */
+static void jitter_report(struct jitter_buffer *jb, const char *when)
+{
+    pthread_mutex_lock(&jb->lock);
+    printf("[GATEWAY] Tampon de gigue (%s) : %lu paquets rejoués, %lu en retard, %lu supprimés, gigue %.1f ms, profondeur %.1f ms\n",
+           when, jb->played, jb->late, jb->dropped, jb->jitter / 1e6, jb->delay / 1e6);
+    fflush(stdout);
+    pthread_mutex_unlock(&jb->lock);
+}
+
+/**
+ * Send count packets to addr with as few sendmmsg calls as possible
+ */
+static void send_batch(int sockfd, struct sockaddr_in *addr, mic_tcp_payload *packets, int count)
+{
+    struct mmsghdr msgs[GATEWAY_BATCH];
+    struct iovec iovs[GATEWAY_BATCH];
+    int k, sent = 0;
+
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for (k = 0; k < count; k++) {
+        iovs[k].iov_base = packets[k].data;
+        iovs[k].iov_len = packets[k].size;
+        msgs[k].msg_hdr.msg_name = addr;
+        msgs[k].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[k].msg_hdr.msg_iov = &iovs[k];
+        msgs[k].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* sendmmsg peut s'arrêter avant la fin du lot */
+    while (sent < count) {
+        int nb_sent = sendmmsg(sockfd, msgs + sent, count - sent, 0);
+        ERROR_IF(nb_sent == -1, "Error sendmmsg");
+        sent += nb_sent;
+    }
+}
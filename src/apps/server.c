@@ -5,7 +5,7 @@
 
 int main()
 {
-    int sockfd;
+    int sockfd, connfd;
     mic_tcp_sock_addr addr;
     mic_tcp_sock_addr remote_addr;
     char chaine[MAX_SIZE];
@@ -34,7 +34,7 @@ int main()
         printf("[TSOCK] Bind du socket MICTCP: OK\n");
     }
 
-    if (mic_tcp_accept(sockfd, &remote_addr) == -1)
+    if ((connfd = mic_tcp_accept(sockfd, &remote_addr)) == -1)
     {
         printf("[TSOCK] Erreur lors de l'accept sur le socket MICTCP!\n");
         return 1;
@@ -52,9 +52,15 @@ int main()
     while(1) {
         int rcv_size = 0;
         printf("[TSOCK] Attente d'une donnee, appel de mic_recv ...\n");
-        rcv_size = mic_tcp_recv(sockfd, chaine, MAX_SIZE);
+        rcv_size = mic_tcp_recv(connfd, chaine, MAX_SIZE);
+        /* 0 : le client a fermé la connexion */
+        if (rcv_size <= 0) break;
         printf("[TSOCK] Reception d'un message de taille : %d\n", rcv_size);
         printf("[TSOCK] Message Recu : %s", chaine);
     }
+
+    mic_tcp_close(connfd);
+    mic_tcp_close(sockfd);
+    printf("[TSOCK] Connexion fermee par le client.\n");
     return 0;
 }
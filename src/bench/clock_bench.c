@@ -0,0 +1,70 @@
+#include <api/mictcp_core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Cost of one read of each clock source, and drift of the TSC clock
+ * against CLOCK_MONOTONIC.
+ */
+
+#define ROUNDS 10000000
+#define DRIFT_MS 1000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Former get_now_time_usec(): wall clock, not monotonic */
+static unsigned long realtime_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (unsigned long)((ts.tv_nsec / 1000) + (ts.tv_sec * 1000000));
+}
+
+static void measure(const char* name, unsigned long (*read)(void))
+{
+    volatile unsigned long sink = 0;
+    int i;
+
+    double t0 = now_ns();
+    unsigned long long c0 = BENCH_CYCLES();
+    for (i = 0; i < ROUNDS; i++) sink += read();
+    unsigned long long c1 = BENCH_CYCLES();
+    double t1 = now_ns();
+
+    (void) sink;
+    printf("%s,%.2f,%.1f\n", name, (t1 - t0) / ROUNDS, (double)(c1 - c0) / ROUNDS);
+}
+
+int main(void)
+{
+    printf("op,ns_per_op,cycles_per_op\n");
+    measure("realtime", realtime_usec);
+    measure("monotonic", get_now_time_usec);
+    mictcp_clock_tick();
+    measure("coarse", get_coarse_time_usec);
+    if (mictcp_clock_use_tsc(1) == -1) {
+        fprintf(stderr, "[BENCH] Invariant TSC unavailable\n");
+        return 0;
+    }
+    measure("tsc", get_now_time_usec);
+
+    /* Both clocks share their origin at calibration: the gap is the drift */
+    struct timespec pause = { .tv_sec = DRIFT_MS / 1000, .tv_nsec = (DRIFT_MS % 1000) * 1000000L };
+    nanosleep(&pause, NULL);
+    const long drift = (long) get_now_time_usec() - (long)(now_ns() / 1000);
+    printf("tsc_drift_us_after_%dms,%ld,0\n", DRIFT_MS, drift);
+    fprintf(stderr, "[BENCH] TSC: %.3f GHz\n", mictcp_clock_tsc_hz() / 1e9);
+    return 0;
+}
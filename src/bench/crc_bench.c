@@ -0,0 +1,168 @@
+#include <api/mictcp_crc32c.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Benchmark of the CRC32C checksum against the per-PDU work of the core:
+ * a data datagram and its ACK, each sent and received over loopback.
+ * The sender checksums the payload while copying it into the datagram,
+ * so it pays only the difference with a plain copy; the receiver checks
+ * the packet in place.
+ */
+
+#define PACKET 1500
+#define ROUNDS 200000
+#define REPEAT 5                /* best of, against the noise of other tenants */
+#define UDP_ROUNDS 50000
+#define ACK_SIZE 28
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * Cost in ns of sending and receiving one datagram of size bytes over loopback
+ */
+static double udp_packet_ns(int size)
+{
+    char buffer[PACKET];
+    struct sockaddr_in addr = {0};
+    socklen_t addr_size = sizeof(addr);
+    int i;
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1
+        || getsockname(fd, (struct sockaddr*)&addr, &addr_size) == -1) {
+        perror("udp socket");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(buffer, 0xa5, sizeof(buffer));
+    double t0 = now_ns();
+    for (i = 0; i < UDP_ROUNDS; i++) {
+        sendto(fd, buffer, size, 0, (struct sockaddr*)&addr, sizeof(addr));
+        recvfrom(fd, buffer, sizeof(buffer), 0, NULL, NULL);
+    }
+    double t1 = now_ns();
+
+    close(fd);
+    return (t1 - t0) / UDP_ROUNDS;
+}
+
+/**
+ * Copy then checksum, the sender's path for the portable implementation
+ */
+static uint32_t sw_copy(uint32_t crc, void* dst, const void* src, size_t size)
+{
+    memcpy(dst, src, size);
+    return mictcp_crc32c_sw(crc, dst, size);
+}
+
+/* Through a pointer, so that the copies compared are real calls */
+static void* (*volatile plain_copy)(void*, const void*, size_t) = memcpy;
+
+static int check(void)
+{
+    static unsigned char data[4096], copy[4096];
+    int size, off;
+
+    if (mictcp_crc32c(0, "123456789", 9) != 0xe3069283 || mictcp_crc32c_sw(0, "123456789", 9) != 0xe3069283) {
+        return -1;
+    }
+
+    for (size = 0; size < (int)sizeof(data); size++) data[size] = rand();
+    for (off = 0; off < 8; off++) {
+        for (size = 0; size + off <= 3000; size += 7) {
+            const uint32_t crc = mictcp_crc32c_sw(0, data + off, size);
+            if (mictcp_crc32c(0, data + off, size) != crc || mictcp_crc32c_copy(0, copy, data + off, size) != crc
+                || memcmp(copy, data + off, size) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int sizes[] = { 64, 256, 512, 1024, 1480 };
+    static unsigned char data[PACKET], copy[PACKET];
+    uint32_t (*impls[2])(uint32_t, const void*, size_t) = { mictcp_crc32c, mictcp_crc32c_sw };
+    uint32_t (*copies[2])(uint32_t, void*, const void*, size_t) = { mictcp_crc32c_copy, sw_copy };
+    const char* names[2] = { mictcp_crc32c_impl(), "slice-by-8" };
+    uint32_t sum = 0;
+    unsigned int s, k;
+    int i, r;
+
+    /* Vérification des implémentations */
+    if (check() == -1) {
+        fprintf(stderr, "[BENCH] CRC32C mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < PACKET; i++) data[i] = rand();
+
+    printf("impl,size,ns_per_packet,cycles_per_packet,gbytes_per_s,send_ns,pdu_ns,percent_of_pdu\n");
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const double udp = udp_packet_ns(sizes[s]) + udp_packet_ns(ACK_SIZE);
+
+        double memcpy_ns = 1e9, t0, t1;
+        for (r = 0; r < REPEAT; r++) {
+            t0 = now_ns();
+            for (i = 0; i < ROUNDS; i++) {
+                plain_copy(copy, data, sizes[s]);
+            }
+            t1 = now_ns();
+            if ((t1 - t0) / ROUNDS < memcpy_ns) memcpy_ns = (t1 - t0) / ROUNDS;
+        }
+
+        for (k = 0; k < 2; k++) {
+            double ns = 1e9, cycles = 0, send = 1e9;
+            for (r = 0; r < REPEAT; r++) {
+                t0 = now_ns();
+                unsigned long long c0 = BENCH_CYCLES();
+                for (i = 0; i < ROUNDS; i++) {
+                    sum += impls[k](sum, data, sizes[s]);
+                }
+                unsigned long long c1 = BENCH_CYCLES();
+                t1 = now_ns();
+                if ((t1 - t0) / ROUNDS < ns) {
+                    ns = (t1 - t0) / ROUNDS;
+                    cycles = (double)(c1 - c0) / ROUNDS;
+                }
+
+                t0 = now_ns();
+                for (i = 0; i < ROUNDS; i++) {
+                    sum += copies[k](sum, copy, data, sizes[s]);
+                }
+                t1 = now_ns();
+                if ((t1 - t0) / ROUNDS - memcpy_ns < send) send = (t1 - t0) / ROUNDS - memcpy_ns;
+            }
+
+            /* Surcoût de la copie en émission, vérification en réception */
+            printf("%s,%d,%.1f,%.1f,%.2f,%.1f,%.1f,%.3f\n", names[k], sizes[s], ns, cycles,
+                   sizes[s] / ns, send, udp, (send + ns) / (udp + send + ns) * 100.0);
+        }
+    }
+
+    /* Empêche l'élimination des boucles par le compilateur */
+    fprintf(stderr, "[BENCH] checksum %08x\n", sum);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Loopback delivery latency (from mic_tcp_send to mic_tcp_recv returning)
+ * with the listener sleeping in recvmsg, then busy-polling, then pinned to
+ * a core as well. Each mode runs in its own process. One CSV line per mode.
+ *
+ * BENCH_MESSAGES sets the number of messages, BENCH_CPU the listener core
+ * (the last one by default). busy_poll_us is -1 when the spin never ends.
+ */
+
+#define MESSAGES 20000
+#define MESSAGE_SIZE 64
+#define PORT 1338
+#define SPIN_FOREVER 1000000000UL
+
+static int messages = MESSAGES;
+static unsigned long* latencies;
+static volatile int listening_ready = 0;
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static int compare(const void* a, const void* b)
+{
+    const unsigned long x = *(const unsigned long*) a, y = *(const unsigned long*) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Puits : mesure la latence de chaque message
+ */
+static void* server_main(void* arg)
+{
+    char buffer[MESSAGE_SIZE];
+    mic_tcp_sock_addr addr = { .ip_addr = NULL, .ip_addr_size = 0, .port = PORT }, remote;
+    unsigned long sent_at;
+    int received = 0;
+
+    int sockfd = mic_tcp_socket(SERVER);
+    if (sockfd == -1 || mic_tcp_bind(sockfd, addr) == -1 || mic_tcp_listen(sockfd) == -1) {
+        fprintf(stderr, "[BENCH] Server setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+    listening_ready = 1;
+    const int connfd = mic_tcp_accept(sockfd, &remote);
+    while (received < messages && mic_tcp_recv(connfd, buffer, sizeof(buffer)) > 0) {
+        const unsigned long now = get_now_time_usec();
+        memcpy(&sent_at, buffer, sizeof(sent_at));
+        latencies[received++] = now - sent_at;
+    }
+    return NULL;
+}
+
+static void run(const char* mode, unsigned long busy_poll, int cpu)
+{
+    char buffer[MESSAGE_SIZE];
+    mic_tcp_sock_addr addr = { .ip_addr = "localhost", .ip_addr_size = 10, .port = PORT };
+    pthread_t server;
+    unsigned long sum = 0;
+    int i;
+
+    latencies = calloc(messages, sizeof(unsigned long));
+    set_loss_rate(0);
+    set_busy_poll(busy_poll);
+    set_listener_cpu(cpu);
+    pthread_create(&server, NULL, server_main, NULL);
+    while (!listening_ready) usleep(1000);
+
+    int sockfd = mic_tcp_socket(CLIENT);
+    if (sockfd == -1 || mic_tcp_setsockopt(sockfd, OPT_RELIABILITY, 100) == -1 || mic_tcp_connect(sockfd, addr) == -1) {
+        fprintf(stderr, "[BENCH] Client connection failed\n");
+        return;
+    }
+
+    memset(buffer, 'x', sizeof(buffer));
+    const double cpu0 = cpu_seconds();
+    for (i = 0; i < messages; i++) {
+        const unsigned long now = get_now_time_usec();
+        memcpy(buffer, &now, sizeof(now));
+        mic_tcp_send(sockfd, buffer, MESSAGE_SIZE);
+    }
+    pthread_join(server, NULL);
+    const double cpu_used = cpu_seconds() - cpu0;
+
+    for (i = 0; i < messages; i++) sum += latencies[i];
+    qsort(latencies, messages, sizeof(unsigned long), compare);
+    printf("%s,%ld,%d,%d,%.1f,%lu,%lu,%lu,%.2f\n", mode, busy_poll == SPIN_FOREVER ? -1L : (long) busy_poll, cpu, messages,
+           (double) sum / messages, latencies[messages / 2], latencies[messages * 99 / 100],
+           latencies[messages * 999 / 1000], cpu_used);
+    fflush(stdout);
+}
+
+int main(void)
+{
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpu = cpus > 1 ? (int) cpus - 1 : 0;
+    unsigned int k;
+
+    if (getenv("BENCH_MESSAGES") != NULL) messages = atoi(getenv("BENCH_MESSAGES"));
+    if (getenv("BENCH_CPU") != NULL) cpu = atoi(getenv("BENCH_CPU"));
+    mictcp_log_set_level(MICTCP_LOG_WARN);
+
+    static const struct { const char* name; unsigned long busy_poll; int pinned; } modes[] = {
+        { "sleep", 0, 0 },
+        { "busy_poll_50us", 50, 0 },
+        { "busy_poll", SPIN_FOREVER, 0 },
+        { "busy_poll_pinned", SPIN_FOREVER, 1 },
+    };
+
+    printf("mode,busy_poll_us,listener_cpu,messages,mean_us,p50_us,p99_us,p999_us,cpu_s\n");
+    fflush(stdout);
+    if (cpus == 1) fprintf(stderr, "[BENCH] Single CPU: spinning yields the processor on every round\n");
+    for (k = 0; k < sizeof(modes) / sizeof(modes[0]); k++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(modes[k].name, modes[k].busy_poll, modes[k].pinned ? cpu : -1);
+            _exit(EXIT_SUCCESS);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <api/mictcp_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Cost of a log call on the caller's side: filtered by level, rate
+ * limited, and actually enqueued for the writer thread.
+ */
+
+#define ROUNDS 1000000
+#define ENQUEUED 400
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void report(const char* name, double t0, double t1, unsigned long long c0, unsigned long long c1, int rounds)
+{
+    printf("%s,%.1f,%.1f\n", name, (t1 - t0) / rounds, (double)(c1 - c0) / rounds);
+}
+
+int main(void)
+{
+    double t0, t1;
+    unsigned long long c0, c1;
+    int i;
+
+    FILE* sink = fopen("/dev/null", "w");
+    if (sink == NULL) return EXIT_FAILURE;
+    mictcp_log_set_output(sink);
+    mictcp_log_set_level(MICTCP_LOG_INFO);
+
+    printf("op,ns_per_op,cycles_per_op\n");
+    mictcp_log_flush();
+
+    t0 = now_ns(); c0 = BENCH_CYCLES();
+    for (i = 0; i < ROUNDS; i++) MICTCP_LOG(MICTCP_LOG_DEBUG, "[BENCH] Perte du paquet #%d", i);
+    c1 = BENCH_CYCLES(); t1 = now_ns();
+    report("filtered", t0, t1, c0, c1, ROUNDS);
+
+    t0 = now_ns(); c0 = BENCH_CYCLES();
+    for (i = 0; i < ROUNDS; i++) MICTCP_LOG(MICTCP_LOG_INFO, "[BENCH] Perte du paquet #%d", i);
+    c1 = BENCH_CYCLES(); t1 = now_ns();
+    report("rate_limited", t0, t1, c0, c1, ROUNDS);
+
+    /* Un site par message pour échapper à la limite de débit */
+    t0 = now_ns(); c0 = BENCH_CYCLES();
+    for (i = 0; i < ENQUEUED; i++) {
+        static mictcp_log_site sites[ENQUEUED];
+        mictcp_log_write(&sites[i], MICTCP_LOG_INFO, "[BENCH] Perte du paquet #%d", i);
+    }
+    c1 = BENCH_CYCLES(); t1 = now_ns();
+    report("enqueued", t0, t1, c0, c1, ENQUEUED);
+
+    mictcp_log_flush();
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <api/mictcp_lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Benchmark of the LZ4 payload compression: ratio, compression and
+ * decompression speed, and cost of the entropy probe that skips
+ * incompressible payloads, for PDU-sized blocks of telemetry, text
+ * and random bytes (standing for H.264 video).
+ */
+
+#define ROUNDS 20000
+#define BLOCK_MAX 4096
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void fill_telemetry(char* data, int size)
+{
+    int offset = 0, k = 0;
+    while (offset < size) {
+        char line[128];
+        const int n = snprintf(line, sizeof(line), "{\"seq\":%d,\"temp\":%d.%d,\"volt\":%d,\"state\":\"%s\"}\n",
+                               k, 20 + rand() % 5, rand() % 10, 3200 + rand() % 100, rand() % 8 ? "ok" : "warn");
+        memcpy(data + offset, line, n < size - offset ? n : size - offset);
+        offset += n;
+        k++;
+    }
+}
+
+static void fill_text(char* data, int size)
+{
+    static const char* words[] = { "le", "paquet", "est", "perdu", "et", "renvoyé", "par", "la", "source",
+                                   "fiabilité", "partielle", "du", "flux", "vidéo", "acquittement" };
+    int offset = 0;
+    while (offset < size) {
+        const char* w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+        const int n = (int) strlen(w);
+        memcpy(data + offset, w, n < size - offset ? n : size - offset);
+        offset += n;
+        if (offset < size) data[offset++] = rand() % 12 ? ' ' : '\n';
+    }
+}
+
+static void fill_random(char* data, int size)
+{
+    int k;
+    for (k = 0; k < size; k++) data[k] = rand();
+}
+
+static int check(void)
+{
+    static char data[BLOCK_MAX], packed[BLOCK_MAX + 64], unpacked[BLOCK_MAX];
+    int size, kind;
+
+    for (kind = 0; kind < 3; kind++) {
+        for (size = 0; size <= BLOCK_MAX; size += 1 + size / 3) {
+            if (kind == 0) fill_telemetry(data, size);
+            else if (kind == 1) fill_text(data, size);
+            else fill_random(data, size);
+            const int n = mictcp_lz4_compress(data, size, packed, sizeof(packed));
+            if (n <= 0 || mictcp_lz4_decompress(packed, n, unpacked, size) != size || memcmp(data, unpacked, size) != 0)
+                return -1;
+            /* A block truncated or decompressed in too small a buffer must be rejected */
+            if (size > 16 && mictcp_lz4_decompress(packed, n, unpacked, size - 1) != -1) return -1;
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const int sizes[] = { 64, 256, 1024, 1400, 4096 };
+    static const char* names[] = { "telemetry", "text", "random" };
+    static char data[BLOCK_MAX], packed[BLOCK_MAX + 64], unpacked[BLOCK_MAX];
+    unsigned long sum = 0;
+    unsigned int s, kind;
+    int i;
+
+    /* Vérification de l'aller-retour */
+    if (check() == -1) {
+        fprintf(stderr, "[BENCH] LZ4 round trip mismatch\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("data,size,compressed,ratio,entropy,compress_mb_s,decompress_mb_s,probe_ns\n");
+    for (kind = 0; kind < 3; kind++) {
+        for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            const int size = sizes[s];
+            if (kind == 0) fill_telemetry(data, size);
+            else if (kind == 1) fill_text(data, size);
+            else fill_random(data, size);
+
+            int n = 0;
+            double t0 = now_ns();
+            for (i = 0; i < ROUNDS; i++) n = mictcp_lz4_compress(data, size, packed, sizeof(packed));
+            double t1 = now_ns();
+            for (i = 0; i < ROUNDS; i++) sum += mictcp_lz4_decompress(packed, n, unpacked, size);
+            double t2 = now_ns();
+            double entropy = 0;
+            for (i = 0; i < ROUNDS; i++) entropy += mictcp_lz4_entropy(data, size);
+            double t3 = now_ns();
+
+            printf("%s,%d,%d,%.3f,%.3f,%.0f,%.0f,%.1f\n", names[kind], size, n, (double) n / size, entropy / ROUNDS,
+                   size * 1e3 * ROUNDS / (t1 - t0), size * 1e3 * ROUNDS / (t2 - t1), (t3 - t2) / ROUNDS);
+        }
+    }
+
+    /* Empêche l'élimination des boucles par le compilateur */
+    fprintf(stderr, "[BENCH] checksum %lu\n", sum);
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+/**
+ * Sender pacing over the in-process simulator: the MICTCP_STREAMS streams
+ * of one connection send full-MSS messages at once through a 10 Mbit/s
+ * bottleneck whose queue holds two PDUs. Unpaced, the streams burst and
+ * overflow the queue; paced near the link rate, they fit. Each pacing rate
+ * runs in its own process, in virtual time. One CSV line per rate.
+ */
+
+#define MESSAGES 200            /* per stream */
+#define MESSAGE_SIZE MICTCP_MSS
+#define PORT 1337
+#define SEED 42
+#define BANDWIDTH 1250000       /* bytes/s */
+#define DELAY 10000             /* us, each way */
+#define QUEUE (2 * (MICTCP_MSS + API_HD_Size))
+
+static int sockfd = -1;
+
+/* Résultats côté puits */
+static unsigned long received = 0;
+static unsigned long latency_sum = 0, latency_max = 0;
+
+/**
+ * Puits : compte les messages et leur latence (en temps virtuel)
+ */
+static void* server_main(void* arg)
+{
+    char buffer[MESSAGE_SIZE];
+    mic_tcp_sock_addr addr = { .ip_addr = NULL, .ip_addr_size = 0, .port = PORT }, remote;
+    unsigned long sent_at;
+    int stream;
+
+    mictcp_sim_attach();
+    int listenfd = mic_tcp_socket(SERVER), connfd = -1;
+    if (listenfd == -1 || mic_tcp_bind(listenfd, addr) == -1 || (connfd = mic_tcp_accept(listenfd, &remote)) == -1) {
+        fprintf(stderr, "[BENCH] Server setup failed\n");
+        return NULL;
+    }
+
+    while (received < MESSAGES * MICTCP_STREAMS && mic_tcp_recv_stream(connfd, &stream, buffer, MESSAGE_SIZE) > 0) {
+        memcpy(&sent_at, buffer, sizeof(sent_at));
+        const unsigned long latency = get_now_time_usec() - sent_at;
+        latency_sum += latency;
+        if (latency > latency_max) latency_max = latency;
+        received++;
+    }
+    return NULL;
+}
+
+/**
+ * Source d'un flux : envoie MESSAGES messages horodatés
+ */
+static void* stream_main(void* arg)
+{
+    char buffer[MESSAGE_SIZE];
+    const int stream = (int)(long) arg;
+    int i;
+
+    mictcp_sim_attach();
+    memset(buffer, 'x', sizeof(buffer));
+    for (i = 0; i < MESSAGES; i++) {
+        const unsigned long now = get_now_time_usec();
+        memcpy(buffer, &now, sizeof(now));
+        mic_tcp_send_stream(sockfd, stream, buffer, MESSAGE_SIZE);
+    }
+    return NULL;
+}
+
+/**
+ * Exécute un échange complet au débit de lissage donné et affiche le résultat
+ */
+static void run(int rate)
+{
+    mic_tcp_sock_addr addr = { .ip_addr = "localhost", .ip_addr_size = 10, .port = PORT };
+    pthread_t server, streams[MICTCP_STREAMS];
+    mictcp_sim_config cfg;
+    mictcp_sim_stats up;
+    mic_tcp_stats st;
+    long k;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.seed = SEED;
+    for (k = 0; k < 2; k++) {
+        cfg.link[k].impair.delay = DELAY;
+        cfg.link[k].bandwidth = BANDWIDTH;
+        cfg.link[k].queue = QUEUE;
+    }
+    mictcp_sim_enable(&cfg);
+    mictcp_sim_reserve();
+    mictcp_sim_reserve();
+    pthread_create(&server, NULL, server_main, NULL);
+
+    /* Connexion depuis le thread principal, qui quitte ensuite la simulation pendant l'envoi */
+    mictcp_sim_attach();
+    sockfd = mic_tcp_socket(CLIENT);
+    if (sockfd == -1 || mic_tcp_setsockopt(sockfd, OPT_RELIABILITY, 100) == -1
+        || mic_tcp_setsockopt(sockfd, OPT_PACING_RATE, rate) == -1 || mic_tcp_connect(sockfd, addr) == -1) {
+        fprintf(stderr, "[BENCH] Client connection failed\n");
+        return;
+    }
+    const unsigned long start = get_now_time_usec();
+    for (k = 0; k < MICTCP_STREAMS; k++) {
+        mictcp_sim_reserve();
+        pthread_create(&streams[k], NULL, stream_main, (void*) k);
+    }
+    mictcp_sim_detach();
+    for (k = 0; k < MICTCP_STREAMS; k++) pthread_join(streams[k], NULL);
+    const unsigned long duration = get_now_time_usec() - start;
+    mictcp_sim_wait_idle();
+
+    mictcp_sim_get_stats(CLIENT, &up);
+    mic_tcp_getstats(sockfd, &st);
+    printf("%d,%d,%d,%lu,%lu,%lu,%.1f,%.1f,%.1f,%lu,%lu\n",
+           rate, BANDWIDTH, MESSAGES * MICTCP_STREAMS, received, up.dropped, st.retransmits,
+           st.pacing_delay / 1000.0, duration / 1000.0, duration > 0 ? received * MESSAGE_SIZE * 1000.0 / duration : 0.0,
+           received > 0 ? latency_sum / received : 0, latency_max);
+}
+
+int main(void)
+{
+    static const int rates[] = { 0, 2 * BANDWIDTH, BANDWIDTH, BANDWIDTH * 9 / 10, BANDWIDTH / 2 };
+    unsigned int r;
+
+    mictcp_log_set_level(MICTCP_LOG_WARN);
+
+    printf("pacing_rate,bandwidth,messages,received,dropped,retransmits,pacing_delay_ms,virtual_ms,goodput_kBps,"
+           "latency_avg_us,latency_max_us\n");
+    fflush(stdout);
+
+    for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        /* Un processus par débit : l'état du protocole repart de zéro */
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(rates[r]);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+
+/**
+ * Sweep of network conditions over the in-process simulator: each
+ * configuration runs a full client/server exchange in its own process,
+ * in virtual time, and prints one CSV line.
+ */
+
+#define MESSAGES 500
+#define MESSAGE_SIZE 1000
+#define PORT 1337
+#define SEED 42
+
+/* Résultats côté puits */
+static unsigned long received = 0;
+static unsigned long latency_sum = 0, latency_max = 0;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/**
+ * Puits : compte les messages et leur latence (en temps virtuel)
+ */
+static void* server_main(void* arg)
+{
+    char buffer[MESSAGE_SIZE];
+    mic_tcp_sock_addr addr = { .ip_addr = NULL, .ip_addr_size = 0, .port = PORT }, remote;
+    unsigned long sent_at;
+
+    mictcp_sim_attach();
+    int sockfd = mic_tcp_socket(SERVER), connfd = -1;
+    if (sockfd == -1 || mic_tcp_bind(sockfd, addr) == -1 || (connfd = mic_tcp_accept(sockfd, &remote)) == -1) {
+        fprintf(stderr, "[BENCH] Server setup failed\n");
+        return NULL;
+    }
+
+    while (mic_tcp_recv(connfd, buffer, MESSAGE_SIZE) > 0) {
+        memcpy(&sent_at, buffer, sizeof(sent_at));
+        const unsigned long latency = get_now_time_usec() - sent_at;
+        latency_sum += latency;
+        if (latency > latency_max) latency_max = latency;
+        received++;
+    }
+    return NULL;
+}
+
+/**
+ * Source : envoie MESSAGES messages horodatés
+ */
+static void* client_main(void* arg)
+{
+    char buffer[MESSAGE_SIZE];
+    mic_tcp_sock_addr addr = { .ip_addr = "localhost", .ip_addr_size = 10, .port = PORT };
+    unsigned long* duration = arg;
+    int i;
+
+    mictcp_sim_attach();
+    int sockfd = mic_tcp_socket(CLIENT);
+    if (sockfd == -1 || mic_tcp_connect(sockfd, addr) == -1) {
+        fprintf(stderr, "[BENCH] Client connection failed\n");
+        return NULL;
+    }
+
+    memset(buffer, 'x', sizeof(buffer));
+    const unsigned long start = get_now_time_usec();
+    for (i = 0; i < MESSAGES; i++) {
+        const unsigned long now = get_now_time_usec();
+        memcpy(buffer, &now, sizeof(now));
+        mic_tcp_send(sockfd, buffer, MESSAGE_SIZE);
+    }
+    *duration = get_now_time_usec() - start;
+    mic_tcp_close(sockfd);
+    return NULL;
+}
+
+/**
+ * Exécute un échange complet avec la configuration donnée et affiche le résultat
+ */
+static void run(const mictcp_sim_config* cfg)
+{
+    pthread_t server, client;
+    unsigned long duration = 0;
+    mictcp_sim_stats up, down;
+    const mictcp_sim_link* link = &cfg->link[CLIENT];
+
+    const double t0 = now_ms();
+    mictcp_sim_enable(cfg);
+    mictcp_sim_reserve();
+    mictcp_sim_reserve();
+    pthread_create(&server, NULL, server_main, NULL);
+    pthread_create(&client, NULL, client_main, &duration);
+    pthread_join(client, NULL);
+    mictcp_sim_wait_idle();
+    const double real = now_ms() - t0;
+
+    mictcp_sim_get_stats(CLIENT, &up);
+    mictcp_sim_get_stats(SERVER, &down);
+    printf("%lu,%lu,%.3f,%.3f,%.3f,%lu,%d,%lu,%.1f,%.1f,%.1f,%lu,%lu,%lu,%lu\n",
+           link->impair.delay, link->impair.jitter, link->impair.loss, link->impair.burst_enter,
+           link->impair.burst_exit, link->bandwidth,
+           MESSAGES, received, duration / 1000.0, real, duration / 1000.0 / real,
+           received > 0 ? latency_sum / received : 0, latency_max, up.dropped, down.dropped);
+}
+
+int main(void)
+{
+    static const unsigned long delays[] = { 1000, 10000, 50000 };
+    static const double losses[][3] = {
+        /* loss, burst_enter, burst_exit */
+        { 0.0, 0.0, 0.0 },
+        { 0.02, 0.0, 0.0 },
+        { 0.0, 0.01, 0.3 },
+    };
+    static const unsigned long bandwidths[] = { 0, 1250000 };
+    unsigned int d, l, b;
+
+    mictcp_log_set_level(MICTCP_LOG_WARN);
+
+    printf("delay_us,jitter_us,loss,burst_enter,burst_exit,bandwidth,messages,received,virtual_ms,real_ms,speedup,"
+           "latency_avg_us,latency_max_us,dropped_up,dropped_down\n");
+    fflush(stdout);
+
+    for (d = 0; d < sizeof(delays) / sizeof(delays[0]); d++) {
+        for (l = 0; l < sizeof(losses) / sizeof(losses[0]); l++) {
+            for (b = 0; b < sizeof(bandwidths) / sizeof(bandwidths[0]); b++) {
+                mictcp_sim_config cfg;
+                int k;
+
+                memset(&cfg, 0, sizeof(cfg));
+                cfg.seed = SEED;
+                for (k = 0; k < 2; k++) {
+                    cfg.link[k].impair.delay = delays[d];
+                    cfg.link[k].impair.jitter = delays[d] / 10;
+                    cfg.link[k].impair.loss = losses[l][0];
+                    cfg.link[k].impair.burst_enter = losses[l][1];
+                    cfg.link[k].impair.burst_exit = losses[l][2];
+                    cfg.link[k].impair.burst_loss = 1.0;
+                    cfg.link[k].bandwidth = bandwidths[b];
+                }
+
+                /* Un processus par configuration : l'état du protocole repart de zéro */
+                pid_t pid = fork();
+                if (pid == 0) {
+                    run(&cfg);
+                    fflush(stdout);
+                    _exit(EXIT_SUCCESS);
+                }
+                waitpid(pid, NULL, 0);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include <mictcp.h>
+#include <api/mictcp_core.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Throughput and latency of the whole stack: a client and a server in the
+ * same process, over the real UDP fake IP, for a sweep of message sizes,
+ * loss rates, reliabilities and windows (set with mic_tcp_setsockopt, so a
+ * plain build is enough). Retransmissions come from mic_tcp_getstats().
+ * One CSV line per run.
+ *
+ * BENCH_MESSAGES sets the number of messages per run.
+ */
+
+#define MESSAGES 1000
+#define MAX_MESSAGE 1400
+#define PORT 1337
+#define DRAIN_MS 300
+
+static int messages = MESSAGES;
+static int message_size;
+static FILE* out;
+
+/* Résultats côté puits */
+static unsigned long* latencies;
+static volatile unsigned long received = 0;
+static volatile unsigned long last_received = 0;
+static volatile int server_listening = 0;
+static volatile int server_socket = -1;
+
+static unsigned long now_usec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+         + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* TSC frequency, to express CPU time in cycles */
+static double tsc_hz(void)
+{
+    const unsigned long t0 = now_usec();
+    const unsigned long long c0 = BENCH_CYCLES();
+    while (now_usec() - t0 < 50000);
+    return (double)(BENCH_CYCLES() - c0) / ((now_usec() - t0) / 1e6);
+}
+
+static int compare(const void* a, const void* b)
+{
+    const unsigned long x = *(const unsigned long*) a, y = *(const unsigned long*) b;
+    return (x > y) - (x < y);
+}
+
+static unsigned long percentile(const unsigned long* sorted, unsigned long count, double p)
+{
+    if (count == 0) return 0;
+    unsigned long k = (unsigned long)(p * count);
+    return sorted[k < count ? k : count - 1];
+}
+
+/**
+ * Puits : horodate la réception de chaque message
+ */
+static void* server_main(void* arg)
+{
+    char buffer[MAX_MESSAGE];
+    mic_tcp_sock_addr addr = { .ip_addr = NULL, .ip_addr_size = 0, .port = PORT }, remote;
+    unsigned long sent_at;
+
+    int sockfd = mic_tcp_socket(SERVER);
+    if (sockfd == -1 || mic_tcp_bind(sockfd, addr) == -1 || mic_tcp_listen(sockfd) == -1) {
+        fprintf(stderr, "[BENCH] Server setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+    server_listening = 1;
+    const int connfd = mic_tcp_accept(sockfd, &remote);
+    if (connfd == -1) {
+        fprintf(stderr, "[BENCH] Server accept failed\n");
+        exit(EXIT_FAILURE);
+    }
+    server_socket = connfd;
+
+    while (mic_tcp_recv(connfd, buffer, sizeof(buffer)) > 0) {
+        const unsigned long now = now_usec();
+        memcpy(&sent_at, buffer, sizeof(sent_at));
+        if (received < (unsigned long) messages) latencies[received] = now - sent_at;
+        last_received = now;
+        received++;
+    }
+    return NULL;
+}
+
+/**
+ * Exécute un échange complet avec la configuration donnée et affiche le résultat
+ */
+static void run(double loss, int reliability, int window, double hz)
+{
+    char buffer[MAX_MESSAGE];
+    mic_tcp_sock_addr addr = { .ip_addr = "localhost", .ip_addr_size = 10, .port = PORT };
+    mictcp_impair impair = { .loss = loss };
+    pthread_t server;
+    int i;
+
+    latencies = malloc(messages * sizeof(unsigned long));
+    set_impairment(&impair);
+    pthread_create(&server, NULL, server_main, NULL);
+
+    /* Le SYN ne doit pas arriver avant l'appel à mic_tcp_listen */
+    while (!server_listening) usleep(1000);
+
+    int sockfd = mic_tcp_socket(CLIENT);
+    if (sockfd == -1 || mic_tcp_setsockopt(sockfd, OPT_RELIABILITY, reliability) == -1
+        || mic_tcp_setsockopt(sockfd, OPT_WINDOW, window) == -1 || mic_tcp_connect(sockfd, addr) == -1) {
+        fprintf(stderr, "[BENCH] Client connection failed\n");
+        return;
+    }
+
+    memset(buffer, 'x', sizeof(buffer));
+    const double cpu0 = cpu_seconds();
+    const unsigned long start = now_usec();
+    for (i = 0; i < messages; i++) {
+        const unsigned long now = now_usec();
+        memcpy(buffer, &now, sizeof(now));
+        mic_tcp_send(sockfd, buffer, message_size);
+    }
+    const unsigned long end = now_usec();
+
+    /* Laisse arriver les derniers messages */
+    usleep(DRAIN_MS * 1000);
+    const double cpu = cpu_seconds() - cpu0;
+    const unsigned long count = received < (unsigned long) messages ? received : (unsigned long) messages;
+    const unsigned long duration = (last_received > end ? last_received : end) - start;
+    mic_tcp_stats st;
+    mic_tcp_getstats(sockfd, &st);
+    static mictcp_hist ack, delivery, connect;
+    mic_tcp_gethist(sockfd, LATENCY_ACK, &ack);
+    mic_tcp_gethist(sockfd, LATENCY_CONNECT, &connect);
+    mic_tcp_gethist(server_socket, LATENCY_DELIVERY, &delivery);
+    const unsigned long packets = messages + st.retransmits;
+
+    qsort(latencies, count, sizeof(unsigned long), compare);
+    fprintf(out, "%d,%.3f,%d,%d,%d,%lu,%.1f,%.3f,%.1f,%lu,%lu,%lu,%lu,%lu,%lu,%.4f,%.0f\n",
+            message_size, loss * 100.0, reliability, window, messages, count,
+            duration / 1000.0, count * message_size * 8.0 / duration, count * 1e6 / duration,
+            percentile(latencies, count, 0.50), percentile(latencies, count, 0.99),
+            percentile(latencies, count, 0.999), mictcp_hist_percentile(&ack, 0.99),
+            mictcp_hist_percentile(&delivery, 0.99), mictcp_hist_mean(&connect), (double) st.retransmits / messages,
+            packets > 0 ? cpu * hz / packets : 0.0);
+    fflush(out);
+}
+
+int main(void)
+{
+    static const int sizes[] = { 64, 512, 1400 };
+    static const double losses[] = { 0.0, 0.02 };
+    static const int reliabilities[] = { 100, 80 };
+    static const int windows[] = { 10, 30 };
+    unsigned int s, l, r, w;
+
+    if (getenv("BENCH_MESSAGES") != NULL) messages = atoi(getenv("BENCH_MESSAGES"));
+    mictcp_log_set_level(MICTCP_LOG_WARN);
+
+    /* Les traces du protocole ne doivent pas se mêler au CSV */
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL) {
+        perror("stdout");
+        return EXIT_FAILURE;
+    }
+
+    const double hz = tsc_hz();
+
+    fprintf(out, "size,loss_pct,reliability,window,messages,delivered,duration_ms,goodput_mbps,"
+                 "msgs_per_s,p50_us,p99_us,p999_us,ack_p99_us,delivery_p99_us,connect_us,retransmit_ratio,"
+                 "cycles_per_packet\n");
+    fflush(out);
+
+    for (r = 0; r < sizeof(reliabilities) / sizeof(reliabilities[0]); r++)
+    for (w = 0; w < sizeof(windows) / sizeof(windows[0]); w++)
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    for (l = 0; l < sizeof(losses) / sizeof(losses[0]); l++) {
+        message_size = sizes[s];
+
+        /* Un processus par configuration : l'état du protocole repart de zéro */
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(losses[l], reliabilities[r], windows[w], hz);
+            _exit(EXIT_SUCCESS);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return 0;
+}
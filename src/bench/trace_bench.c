@@ -0,0 +1,61 @@
+#include <api/mictcp_trace.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Cost of one trace event, with tracing off and on, and of a dump.
+ */
+
+#define ROUNDS 10000000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void measure(const char* name)
+{
+    mic_tcp_header hd = { .source_port = 1, .dest_port = 2, .seq_num = 0, .ack_num = 0, .syn = 0, .ack = 1 };
+    int i;
+
+    double t0 = now_ns();
+    unsigned long long c0 = BENCH_CYCLES();
+    for (i = 0; i < ROUNDS; i++) {
+        hd.seq_num = i;
+        MICTCP_TRACE(TRACE_TX, 0, &hd, 1000, 0);
+        __asm__ volatile("" ::: "memory");
+    }
+    unsigned long long c1 = BENCH_CYCLES();
+    double t1 = now_ns();
+
+    printf("%s,%.2f,%.1f\n", name, (t1 - t0) / ROUNDS, (double)(c1 - c0) / ROUNDS);
+}
+
+int main(void)
+{
+    const char* path = "build/bench/trace.pcapng";
+
+    printf("op,ns_per_op,cycles_per_op\n");
+    measure("event_off");
+    mictcp_trace_enable(1);
+    measure("event_on");
+
+    double t0 = now_ns();
+    int events = mictcp_trace_dump(path);
+    double t1 = now_ns();
+    if (events == -1) {
+        perror(path);
+        return EXIT_FAILURE;
+    }
+    printf("dump_%d_events,%.0f,0\n", events, t1 - t0);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include <api/mictcp_wire.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_CYCLES() __rdtsc()
+#else
+#define BENCH_CYCLES() 0ULL
+#endif
+
+/**
+ * Microbenchmark of the MICTCP header encode/decode helpers.
+ */
+
+#define HEADERS 1024
+#define ROUNDS 50000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void)
+{
+    static unsigned char packets[HEADERS][MICTCP_WIRE_HEADER_SIZE];
+    mic_tcp_header hd;
+    unsigned long sum = 0;
+    int i, r;
+
+    /* Préparation d'en-têtes variés */
+    srand(42);
+    for (i = 0; i < HEADERS; i++)
+    {
+        hd.source_port = rand();
+        hd.dest_port = rand();
+        hd.seq_num = rand();
+        hd.ack_num = rand();
+        hd.syn = rand() & 1;
+        hd.ack = rand() & 1;
+        hd.fin = rand() & 1;
+        hd.more = rand() & 1;
+        hd.batch = rand() & 1;
+        hd.compressed = rand() & 1;
+        hd.window = rand();
+        hd.stream = rand() % MICTCP_STREAMS;
+        mictcp_wire_encode(&hd, packets[i], MICTCP_WIRE_HEADER_SIZE);
+    }
+
+    printf("op,ns_per_op,cycles_per_op\n");
+
+    /* Décodage */
+    double t0 = now_ns();
+    unsigned long long c0 = BENCH_CYCLES();
+    for (r = 0; r < ROUNDS; r++)
+    {
+        for (i = 0; i < HEADERS; i++)
+        {
+            sum += mictcp_wire_decode(packets[i], MICTCP_WIRE_HEADER_SIZE, &hd);
+            sum += hd.seq_num ^ hd.ack_num ^ hd.fin;
+        }
+    }
+    unsigned long long c1 = BENCH_CYCLES();
+    double t1 = now_ns();
+    const double ops = (double)ROUNDS * HEADERS;
+    printf("decode,%.2f,%.2f\n", (t1 - t0) / ops, (double)(c1 - c0) / ops);
+
+    /* Encodage */
+    t0 = now_ns();
+    c0 = BENCH_CYCLES();
+    for (r = 0; r < ROUNDS; r++)
+    {
+        for (i = 0; i < HEADERS; i++)
+        {
+            hd.seq_num = r + i;
+            mictcp_wire_encode(&hd, packets[i], MICTCP_WIRE_HEADER_SIZE);
+        }
+        sum += packets[r % HEADERS][MICTCP_WIRE_OFF_SEQ + 3];
+    }
+    c1 = BENCH_CYCLES();
+    t1 = now_ns();
+    printf("encode,%.2f,%.2f\n", (t1 - t0) / ops, (double)(c1 - c0) / ops);
+
+    /* Empêche l'élimination des boucles par le compilateur */
+    fprintf(stderr, "[BENCH] checksum %lu\n", sum);
+    return 0;
+}
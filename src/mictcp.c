@@ -1,54 +1,703 @@
 #include <mictcp.h>
 #include <api/mictcp_core.h>
+#include <api/mictcp_lz4.h>
+#include <api/mictcp_siphash.h>
 #include <limits.h>
 
 // Sockets.
 mic_tcp_sock sockets[MICTCP_SOCKETS];
 // Adresses distantes.
 mic_tcp_sock_addr connections[MICTCP_SOCKETS];
-// Numéros de séquence.
-unsigned int seq[MICTCP_SOCKETS];
-// Distance maximale de perte.
-unsigned int loss_distance_max[MICTCP_SOCKETS];
-// Distances de perte.
-unsigned int loss_distance[MICTCP_SOCKETS];
+// Numéros de séquence, par flux.
+unsigned int seq[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Distance maximale de perte, par flux.
+unsigned int loss_distance_max[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Distances de perte, par flux.
+unsigned int loss_distance[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Fiabilités partielles proposées par flux (-1 : celle de OPT_RELIABILITY).
+int proposals[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Options des sockets.
+int options[MICTCP_SOCKETS][OPTIONS];
+// Valeurs par défaut des options (macros, puis variables d'environnement).
+static int default_options[OPTIONS] = {
+	[OPT_TIMEOUT_ACK] = MICTCP_TIMEOUT_ACK,
+	[OPT_TIMEOUT_CONNECT] = MICTCP_TIMEOUT_CONNECT,
+	[OPT_WINDOW] = MICTCP_WINDOW,
+	[OPT_RELIABILITY] = MICTCP_RELIABILITY,
+	[OPT_RETRIES] = MICTCP_RETRIES,
+	[OPT_RTO] = MICTCP_RTO,
+	[OPT_RTO_MIN] = MICTCP_RTO_MIN,
+	[OPT_RTO_MAX] = MICTCP_RTO_MAX,
+	[OPT_MSS] = MICTCP_MSS,
+	[OPT_CORK] = MICTCP_CORK,
+	[OPT_CORK_DELAY] = MICTCP_CORK_DELAY,
+	[OPT_COMPRESS] = MICTCP_COMPRESS,
+	[OPT_RESUME] = MICTCP_RESUME,
+	[OPT_TIME_WAIT] = MICTCP_TIME_WAIT,
+	[OPT_BACKLOG] = MICTCP_BACKLOG,
+	[OPT_PACING_RATE] = MICTCP_PACING_RATE,
+	[OPT_PACING_BURST] = MICTCP_PACING_BURST
+};
+// Noms des variables d'environnement des options.
+static const char* option_names[OPTIONS] = {
+	[OPT_TIMEOUT_ACK] = "MICTCP_TIMEOUT_ACK",
+	[OPT_TIMEOUT_CONNECT] = "MICTCP_TIMEOUT_CONNECT",
+	[OPT_WINDOW] = "MICTCP_WINDOW",
+	[OPT_RELIABILITY] = "MICTCP_RELIABILITY",
+	[OPT_RETRIES] = "MICTCP_RETRIES",
+	[OPT_RTO] = "MICTCP_RTO",
+	[OPT_RTO_MIN] = "MICTCP_RTO_MIN",
+	[OPT_RTO_MAX] = "MICTCP_RTO_MAX",
+	[OPT_MSS] = "MICTCP_MSS",
+	[OPT_CORK] = "MICTCP_CORK",
+	[OPT_CORK_DELAY] = "MICTCP_CORK_DELAY",
+	[OPT_COMPRESS] = "MICTCP_COMPRESS",
+	[OPT_RESUME] = "MICTCP_RESUME",
+	[OPT_TIME_WAIT] = "MICTCP_TIME_WAIT",
+	[OPT_BACKLOG] = "MICTCP_BACKLOG",
+	[OPT_PACING_RATE] = "MICTCP_PACING_RATE",
+	[OPT_PACING_BURST] = "MICTCP_PACING_BURST"
+};
+static pthread_once_t options_once = PTHREAD_ONCE_INIT;
+// Tailles maximales des données d'un PDU négociées.
+int mss[MICTCP_SOCKETS];
+// Compression LZ4 négociée (1) ou non (0).
+int compression[MICTCP_SOCKETS];
+// Messages en cours de réassemblage, par flux.
+static mic_tcp_payload segments[MICTCP_SOCKETS][MICTCP_STREAMS];
+static int segments_capacity[MICTCP_SOCKETS][MICTCP_STREAMS];
+static int segments_discarded[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Modes (CLIENT ou SERVER) des sockets.
+start_mode modes[MICTCP_SOCKETS];
+// Petits messages en attente de regroupement, par flux : taille sur 2 octets, puis données.
+static pthread_mutex_t cork_locks[MICTCP_SOCKETS][MICTCP_STREAMS] = {
+	[0 ... MICTCP_SOCKETS - 1] = { [0 ... MICTCP_STREAMS - 1] = PTHREAD_MUTEX_INITIALIZER }
+};
+static mic_tcp_payload corks[MICTCP_SOCKETS][MICTCP_STREAMS];
+static int corks_capacity[MICTCP_SOCKETS][MICTCP_STREAMS];
+static int corks_count[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Échéances d'envoi des regroupements incomplets (µs, horloge monotone, 0 si vide).
+static unsigned long corks_deadline[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Thread d'envoi des regroupements arrivés à échéance.
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flusher_cond;
+static pthread_once_t flusher_once = PTHREAD_ONCE_INIT;
+// Pourcentages de fiabilité partielle négociés, par flux.
+char reliabilities[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Réception des ACK : un seul thread émetteur lit le socket système à la fois
+// et dépose les ACK des autres flux et connexions dans acks.
+static pthread_mutex_t ack_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ack_cond;
+static pthread_once_t ack_once = PTHREAD_ONCE_INIT;
+static int ack_reading = 0;
+// Lectures terminées, pour les attentes en temps virtuel (voir await_pdu).
+static unsigned long ack_reads = 0;
+static unsigned int acks[MICTCP_SOCKETS][MICTCP_STREAMS];
+// Appels de mic_tcp_send_stream en cours, attendus par mic_tcp_close avant le FIN.
+static int sending[MICTCP_SOCKETS];
+// Lissage de l'émission (OPT_PACING_RATE) : crédit du seau à jetons en millionièmes d'octet,
+// négatif quand un envoi attend, et date de sa dernière mise à jour (µs, 0 : seau plein).
+static pthread_mutex_t pacer_locks[MICTCP_SOCKETS] = {
+	[0 ... MICTCP_SOCKETS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+static long long pacer_credit[MICTCP_SOCKETS];
+static unsigned long pacer_stamp[MICTCP_SOCKETS];
+// Fin de l'état TIME_WAIT d'un socket serveur (µs).
+static unsigned long time_wait_deadline[MICTCP_SOCKETS];
+// Fin de flux remise à l'application : les réceptions suivantes retournent 0 aussitôt.
+static int eof[MICTCP_SOCKETS];
+// Statistiques des sockets, lues sans verrou par mic_tcp_getstats().
+mic_tcp_stats stats[MICTCP_SOCKETS];
+// Histogrammes de latence des sockets (µs).
+mictcp_hist latencies[MICTCP_SOCKETS][LATENCIES];
 // Descripteur du prochain socket.
 int socketd = 0;
-// Socket sélectionné.
-int current_socket = MICTCP_SOCKETS;
+// Attribution des descripteurs, par l'application et par le thread d'écoute.
+static pthread_mutex_t socket_lock = PTHREAD_MUTEX_INITIALIZER;
+// Dernier port attribué à un socket client non lié.
+static unsigned short ephemeral_port = 0;
 
-// Prépare la charge utile d'un PDU à recevoir un pourcentage de fiabilité partielle.
+// Socket d'écoute d'une connexion pas encore remise par mic_tcp_accept (-1 sinon).
+static int parents[MICTCP_SOCKETS];
+// File des connexions établies d'un socket d'écoute (anneau), et nombre de connexions en
+// cours d'établissement (SYN_RECEIVED) ; les deux ensemble ne dépassent pas OPT_BACKLOG.
+static pthread_mutex_t accept_lock = PTHREAD_MUTEX_INITIALIZER;
+static int accept_queue[MICTCP_SOCKETS][MICTCP_SOCKETS];
+static int accept_head[MICTCP_SOCKETS];
+static int accept_count[MICTCP_SOCKETS];
+static int half_open[MICTCP_SOCKETS];
+// Abandon d'une connexion en cours d'établissement dont le client ne répond plus (µs).
+static unsigned long half_open_deadline[MICTCP_SOCKETS];
+
+// Charge utile des PDU de poignée de main : fiabilité partielle de chaque flux, MSS sur 2 octets,
+// puis compressions acceptées.
+#define HANDSHAKE_SIZE (MICTCP_STREAMS + 3)
+#define HANDSHAKE_LZ4 0x01
+
+// Jeton de reprise (OPT_RESUME) : marque (jamais une fiabilité valide), paramètres négociés au
+// format de la poignée de main, date d'émission (s) et numéro unique sur 4 octets chacun, puis
+// code d'authentification SipHash calculé avec la clé secrète du serveur.
+#define TOKEN_MAGIC 0xff
+#define TOKEN_ISSUED (1 + HANDSHAKE_SIZE)
+#define TOKEN_NONCE (TOKEN_ISSUED + 4)
+#define TOKEN_MAC (TOKEN_NONCE + 4)
+#define TOKEN_SIZE (TOKEN_MAC + 8)
+// SYN cookie : jeton au même format, marqué COOKIE_MAGIC, dont le code d'authentification
+// couvre aussi le port du client. Envoyé avec le SYN ACK d'un socket d'écoute dont la file
+// est pleine, il est présenté par le premier PDU de données, comme un jeton de reprise.
+#define COOKIE_MAGIC 0xfe
+#define COOKIE_LIFETIME 10 // s
+// Premier port attribué aux sockets clients non liés.
+#define EPHEMERAL_MIN 49152
+// Numéros des jetons acceptés par le serveur, gardés jusqu'à leur expiration contre le rejeu.
+#define RESUME_REPLAY 256
+
+// États d'une reprise côté client : jeton à présenter avec le premier PDU de données,
+// PDU porteur envoyé, ou jeton refusé par le serveur.
+#define RESUME_PENDING 1
+#define RESUME_IN_FLIGHT 2
+#define RESUME_REFUSED 3
+
+// Jeton de reprise d'un socket : à présenter (client) ou dernier délivré (serveur).
+static unsigned char tokens[MICTCP_SOCKETS][TOKEN_SIZE];
+// SYN ACK déposé à un socket client en cours de poignée de main (taille -1 si aucun).
+static mic_tcp_header syn_ack_headers[MICTCP_SOCKETS];
+static char syn_ack_payloads[MICTCP_SOCKETS][HANDSHAKE_SIZE + TOKEN_SIZE];
+static int syn_ack_sizes[MICTCP_SOCKETS];
+// État de la reprise d'un socket client (0 si aucune).
+static int resuming[MICTCP_SOCKETS];
+// Numéro du jeton accepté par un socket serveur (0 si la connexion n'a pas été reprise).
+static unsigned int resumed_nonce[MICTCP_SOCKETS];
+// Jetons reçus par les clients, un par serveur, à usage unique.
+typedef struct resume_entry
+{
+	char ip[64];
+	unsigned short port;
+	unsigned char token[TOKEN_SIZE];
+	unsigned long stored_at; /* µs, 0 si libre */
+} resume_entry;
+static resume_entry resume_cache[MICTCP_RESUME_CACHE];
+static pthread_mutex_t resume_lock = PTHREAD_MUTEX_INITIALIZER;
+// Clé secrète des jetons du serveur, et dernier numéro de jeton délivré.
+static unsigned char resume_key[16];
+static pthread_once_t resume_once = PTHREAD_ONCE_INIT;
+static unsigned int resume_nonce = 0;
+// Jetons acceptés (numéro et expiration en s), lus par le seul thread d'écoute.
+static struct { unsigned int nonce; unsigned long expiry; } resume_replay[RESUME_REPLAY];
+
+// Prépare la charge utile d'un PDU à recevoir les paramètres de poignée de main.
 static void prepare_for_reliability(mic_tcp_pdu* pdu)
 {
-	pdu->payload.size = 2;
-	pdu->payload.data = (char*)malloc(2);
-	pdu->payload.data[1] = 0;
+	pdu->payload.size = HANDSHAKE_SIZE;
+	pdu->payload.data = (char*)calloc(HANDSHAKE_SIZE, 1);
 }
-// Écris un pourcentage de fiabilité partielle dans la charge utile d'un PDU.
-static void export_reliability(mic_tcp_pdu* pdu, char reliability)
+// Écris les pourcentages de fiabilité partielle des flux dans la charge utile d'un PDU.
+static void export_reliability(mic_tcp_pdu* pdu, const char* reliabilities)
 {
 	prepare_for_reliability(pdu);
-	pdu->payload.data[0] = reliability;
+	memcpy(pdu->payload.data, reliabilities, MICTCP_STREAMS);
+}
+// Écris la MSS proposée (ou retenue) dans la charge utile d'un PDU préparé.
+static void export_mss(mic_tcp_pdu* pdu, int value)
+{
+	pdu->payload.data[MICTCP_STREAMS] = (char)(value >> 8);
+	pdu->payload.data[MICTCP_STREAMS + 1] = (char)(value & 0xff);
+}
+// Lis la MSS de la charge utile d'un PDU, limitée à local (valeur locale si absente).
+static int import_mss(mic_tcp_pdu* pdu, int local)
+{
+	if (pdu->payload.size >= MICTCP_STREAMS + 2)
+	{
+		const int value = (unsigned char)pdu->payload.data[MICTCP_STREAMS] << 8 | (unsigned char)pdu->payload.data[MICTCP_STREAMS + 1];
+		if (value > 0 && value < local)
+			return value;
+	}
+	return local;
 }
-// Lis un pourcentage de fiabilité partielle dans la charge utile d'un PDU.
-static char import_reliability(mic_tcp_pdu* pdu)
+// Écris la compression proposée (ou retenue) dans la charge utile d'un PDU préparé.
+static void export_compression(mic_tcp_pdu* pdu, int value)
 {
-	if (pdu->payload.size > 0)
+	pdu->payload.data[MICTCP_STREAMS + 2] = value ? HANDSHAKE_LZ4 : 0;
+}
+// Lis la compression de la charge utile d'un PDU : retenue si les deux extrémités l'acceptent.
+static int import_compression(mic_tcp_pdu* pdu, int local)
+{
+	return local && pdu->payload.size >= HANDSHAKE_SIZE && (pdu->payload.data[MICTCP_STREAMS + 2] & HANDSHAKE_LZ4);
+}
+// Lis le pourcentage de fiabilité partielle d'un flux dans la charge utile d'un PDU.
+static char import_reliability(mic_tcp_pdu* pdu, int stream)
+{
+	if (pdu->payload.size > stream)
 	{
-		const char reliability = pdu->payload.data[0];
+		const char reliability = pdu->payload.data[stream];
 		if (reliability >= 0 && reliability <= 100)
 			return reliability;
 	}
 	return MICTCP_RELIABILITY_DEFAULT;
 }
 
+// Mise à jour des statistiques : chaque compteur n'a qu'un écrivain, les
+// accès atomiques relâchés permettent une lecture depuis un autre thread.
+#define STAT_ADD(socket, field, value) __atomic_fetch_add(&stats[socket].field, (value), __ATOMIC_RELAXED)
+#define STAT_SET(socket, field, value) __atomic_store_n(&stats[socket].field, (value), __ATOMIC_RELAXED)
+#define STAT_GET(socket, field) __atomic_load_n(&stats[socket].field, __ATOMIC_RELAXED)
+
+// Intègre une mesure de RTT (lissage de la RFC 6298).
+static void update_rtt(int socket, unsigned long rtt)
+{
+	const unsigned long min = STAT_GET(socket, rtt_min);
+	if (min == 0 || rtt < min)
+		STAT_SET(socket, rtt_min, rtt);
+	if (STAT_GET(socket, rtt_avg) == 0)
+	{
+		STAT_SET(socket, rtt_avg, rtt);
+		STAT_SET(socket, rtt_var, rtt / 2);
+		return;
+	}
+	const unsigned long avg = STAT_GET(socket, rtt_avg), var = STAT_GET(socket, rtt_var);
+	const unsigned long delta = avg > rtt ? avg - rtt : rtt - avg;
+	STAT_SET(socket, rtt_var, var - var / 4 + delta / 4);
+	STAT_SET(socket, rtt_avg, avg - avg / 8 + rtt / 8);
+}
+
+// Indique si un numéro de flux est valide.
+static int stream_valid(int stream)
+{ return stream >= 0 && stream < MICTCP_STREAMS; }
+
 // Évalue une distance maximale de perte admissible depuis un pourcentage de fiabilité.
-static unsigned int loss_distance_max_from_reliability(char reliability)
-{ return reliability > 0 ? (unsigned int)((float)MICTCP_WINDOW * (1.0f - (float)reliability / 100.f)) : UINT_MAX; }
+static unsigned int loss_distance_max_from_reliability(int socket, char reliability)
+{ return reliability > 0 ? (unsigned int)((float)options[socket][OPT_WINDOW] * (1.0f - (float)reliability / 100.f)) : UINT_MAX; }
 
-#ifdef MICTCP_DEBUG_RELIABILITY
-	unsigned int sent = 0, lost = 0, resent = 0;
-#endif
+// Indique si une valeur est admissible pour une option.
+static int option_valid(mic_tcp_option option, int value)
+{
+	switch (option)
+	{
+		case OPT_RELIABILITY: return value >= 0 && value <= 100;
+		case OPT_LOSS_RATE: return value >= 0 && value <= 100;
+		case OPT_PACING_RATE: return value >= 0;
+		case OPT_RTO: case OPT_CORK: case OPT_COMPRESS: case OPT_RESUME: return value == 0 || value == 1;
+		case OPT_RETRIES: case OPT_WINDOW: return value >= 1;
+		case OPT_BACKLOG: return value >= 1 && value < MICTCP_SOCKETS;
+		case OPT_MSS: return value >= 1 && value <= API_MAX_DATAGRAM - API_HD_Size - API_CRC_Size;
+		default: return value > 0;
+	}
+}
+
+// Lis les valeurs par défaut des options dans l'environnement.
+static void load_options(void)
+{
+	int o;
+	for (o = 0; o < OPTIONS; o++)
+	{
+		const char* value = option_names[o] != NULL ? getenv(option_names[o]) : NULL;
+		if (value == NULL)
+			continue;
+		char* end;
+		const long v = strtol(value, &end, 10);
+		if (end != value && *end == '\0' && v <= INT_MAX && option_valid(o, (int)v))
+			default_options[o] = (int)v;
+		else
+			MICTCP_LOG(MICTCP_LOG_ERROR, "[MIC-TCP] %s invalide : %s", option_names[o], value);
+	}
+}
+
+// Tire la clé secrète des jetons de reprise du serveur.
+static void load_resume_key(void)
+{
+	FILE* f = fopen("/dev/urandom", "rb");
+	if (f == NULL || fread(resume_key, 1, sizeof(resume_key), f) != sizeof(resume_key))
+	{
+		// À défaut, une clé propre au processus, mais prévisible.
+		const unsigned long long seed[2] = { get_now_time_usec(), (unsigned long long)getpid() };
+		memcpy(resume_key, seed, sizeof(resume_key));
+		MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] /dev/urandom indisponible, clé des jetons de reprise prévisible.");
+	}
+	if (f != NULL)
+		fclose(f);
+}
+
+static void put_u32(unsigned char* p, unsigned int value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static unsigned int get_u32(const unsigned char* p)
+{ return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16 | (unsigned int)p[2] << 8 | p[3]; }
+
+// Date courante des jetons de reprise (s).
+static unsigned int token_now(void)
+{ return (unsigned int)(get_now_time_usec() / 1000000); }
+
+// Vue sur les paramètres de poignée de main d'un jeton de reprise.
+static mic_tcp_pdu token_parameters(const unsigned char* token)
+{
+	mic_tcp_pdu view = { .payload = { .data = (char*)token + 1, .size = HANDSHAKE_SIZE } };
+	return view;
+}
+
+// Code d'authentification d'un jeton, qui couvre aussi le port du client pour un SYN cookie.
+static uint64_t token_mac(const unsigned char* token, unsigned short port)
+{
+	unsigned char message[TOKEN_MAC + 2];
+	pthread_once(&resume_once, load_resume_key);
+	memcpy(message, token, TOKEN_MAC);
+	message[TOKEN_MAC] = port >> 8;
+	message[TOKEN_MAC + 1] = port;
+	return mictcp_siphash(resume_key, message, token[0] == COOKIE_MAGIC ? TOKEN_MAC + 2 : TOKEN_MAC);
+}
+
+// Remplit un jeton de reprise (TOKEN_MAGIC) ou un SYN cookie (COOKIE_MAGIC, pour le client
+// de port port) avec des paramètres négociés.
+static void make_token(unsigned char* token, unsigned char magic, const char* values, int size, int compress, unsigned short port)
+{
+	mic_tcp_pdu view = token_parameters(token);
+	unsigned int nonce;
+	token[0] = magic;
+	memcpy(token + 1, values, MICTCP_STREAMS);
+	export_mss(&view, size);
+	export_compression(&view, compress);
+	put_u32(token + TOKEN_ISSUED, token_now());
+	// Le numéro 0 désigne une connexion non reprise.
+	do nonce = __atomic_add_fetch(&resume_nonce, 1, __ATOMIC_RELAXED);
+	while (nonce == 0);
+	put_u32(token + TOKEN_NONCE, nonce);
+	const uint64_t mac = token_mac(token, port);
+	memcpy(token + TOKEN_MAC, &mac, sizeof(mac));
+}
+
+// Délivre un nouveau jeton de reprise pour les paramètres négociés d'un socket serveur.
+static void issue_token(int socket)
+{ make_token(tokens[socket], TOKEN_MAGIC, reliabilities[socket], mss[socket], compression[socket], 0); }
+
+// Indique si un jeton de reprise, ou un SYN cookie présenté par le client de port port, a été
+// délivré par ce serveur et n'a pas expiré.
+static int token_valid(const unsigned char* token, unsigned short port)
+{
+	const int cookie = token[0] == COOKIE_MAGIC;
+	const uint64_t mac = token_mac(token, port);
+	const unsigned char* expected = (const unsigned char*)&mac;
+	unsigned char diff = cookie ? 0 : token[0] ^ TOKEN_MAGIC;
+	int k;
+	// Comparaison en temps constant : la durée ne révèle pas l'octet fautif.
+	for (k = 0; k < 8; k++)
+		diff |= token[TOKEN_MAC + k] ^ expected[k];
+	const unsigned int now = token_now(), issued = get_u32(token + TOKEN_ISSUED);
+	return diff == 0 && issued <= now && now - issued < (cookie ? COOKIE_LIFETIME : MICTCP_RESUME_LIFETIME);
+}
+
+// Garde le jeton de reprise délivré par un serveur, à la place du précédent ou du plus ancien.
+static void resume_store(mic_tcp_sock_addr addr, const unsigned char* token)
+{
+	if (addr.ip_addr == NULL || token[0] != TOKEN_MAGIC)
+		return;
+	pthread_mutex_lock(&resume_lock);
+	resume_entry* entry = &resume_cache[0];
+	int k;
+	for (k = 0; k < MICTCP_RESUME_CACHE; k++)
+	{
+		resume_entry* e = &resume_cache[k];
+		if (e->stored_at != 0 && e->port == addr.port && strncmp(e->ip, addr.ip_addr, sizeof(e->ip)) == 0)
+		{
+			entry = e;
+			break;
+		}
+		if (e->stored_at < entry->stored_at)
+			entry = e;
+	}
+	snprintf(entry->ip, sizeof(entry->ip), "%s", addr.ip_addr);
+	entry->port = addr.port;
+	memcpy(entry->token, token, TOKEN_SIZE);
+	entry->stored_at = get_now_time_usec();
+	pthread_mutex_unlock(&resume_lock);
+}
+
+// Retire le jeton de reprise gardé pour un serveur (usage unique).
+// Retourne 1 s'il existe et n'a pas expiré, 0 sinon.
+static int resume_take(mic_tcp_sock_addr addr, unsigned char* token)
+{
+	int found = 0, k;
+	if (addr.ip_addr == NULL)
+		return 0;
+	pthread_mutex_lock(&resume_lock);
+	for (k = 0; k < MICTCP_RESUME_CACHE; k++)
+	{
+		resume_entry* e = &resume_cache[k];
+		if (e->stored_at != 0 && e->port == addr.port && strncmp(e->ip, addr.ip_addr, sizeof(e->ip)) == 0)
+		{
+			found = get_now_time_usec() - e->stored_at < MICTCP_RESUME_LIFETIME * 1000000UL;
+			memcpy(token, e->token, TOKEN_SIZE);
+			e->stored_at = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&resume_lock);
+	return found;
+}
+
+// Délai d'attente d'un ACK : fixe, ou adaptatif (RFC 6298) avec doublement à chaque renvoi.
+static unsigned long ack_timeout(int socket, int tries)
+{
+	if (!options[socket][OPT_RTO] || STAT_GET(socket, rtt_avg) == 0)
+		return options[socket][OPT_TIMEOUT_ACK];
+	unsigned long rto = (STAT_GET(socket, rtt_avg) + 4 * STAT_GET(socket, rtt_var) + 999) / 1000;
+	rto <<= (tries > 1 ? (tries - 1 < 16 ? tries - 1 : 16) : 0);
+	if (rto < (unsigned long)options[socket][OPT_RTO_MIN])
+		rto = options[socket][OPT_RTO_MIN];
+	if (rto > (unsigned long)options[socket][OPT_RTO_MAX])
+		rto = options[socket][OPT_RTO_MAX];
+	return rto;
+}
+
+// Les attentes d'un ACK suivent l'horloge du protocole (CLOCK_MONOTONIC), pas l'heure système.
+static void init_ack_cond(void)
+{
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ack_cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+// Change l'état d'un socket.
+static void set_state(int socket, protocol_state state)
+{
+	MICTCP_TRACE(TRACE_STATE, socket, NULL, 0, state);
+	__atomic_store_n(&sockets[socket].state, state, __ATOMIC_SEQ_CST);
+}
+
+// Socket client auquel est destiné un PDU lu sur le socket système du client (ports de
+// l'en-tête de sa connexion), -1 si aucun.
+static int client_socket(mic_tcp_pdu* pdu)
+{
+	int s;
+	for (s = 0; s < socketd; s++)
+		if (modes[s] == CLIENT && sockets[s].addr.port == pdu->header.dest_port && connections[s].port == pdu->header.source_port
+			&& (sockets[s].state == SYN_SENT || sockets[s].state == ESTABLISHED || sockets[s].state == CLOSING
+				|| sockets[s].state == CLOSE_WAIT))
+			return s;
+	return -1;
+}
+
+// Remet un PDU lu par le client au socket auquel il est destiné (ack_lock tenu) : le SYN ACK
+// d'une poignée de main en cours est gardé pour elle, le ACK d'un PDU porteur d'un jeton de
+// reprise apporte un nouveau jeton, ou son refus ; un FIN du serveur ferme la connexion
+// (CLOSE_WAIT).
+static void deliver_pdu(mic_tcp_pdu* pdu, int received)
+{
+	const int owner = client_socket(pdu);
+	if (owner < 0)
+		return;
+	STAT_ADD(owner, pdus_received, 1);
+	if (sockets[owner].state == SYN_SENT)
+	{
+		if (pdu->header.syn == 1 && pdu->header.ack == 1)
+		{
+			syn_ack_headers[owner] = pdu->header;
+			memcpy(syn_ack_payloads[owner], pdu->payload.data, received);
+			syn_ack_sizes[owner] = received;
+		}
+		return;
+	}
+	if (pdu->header.syn == 1 && pdu->header.ack == 1 && resuming[owner] == RESUME_IN_FLIGHT)
+	{
+		if (received == TOKEN_SIZE)
+		{
+			resume_store(connections[owner], (unsigned char*)pdu->payload.data);
+			resuming[owner] = 0;
+		}
+		else if (received == 0)
+			resuming[owner] = RESUME_REFUSED;
+	}
+	if (pdu->header.fin == 1 && pdu->header.ack == 0 && sockets[owner].state != CLOSE_WAIT)
+	{
+		set_state(owner, CLOSE_WAIT);
+		#ifdef MICTCP_DEBUG_CONNECTION
+			MICTCP_LOG(MICTCP_LOG_DEBUG, "Connection closed by peer.");
+		#endif
+	}
+	if (pdu->header.ack == 1 && stream_valid(pdu->header.stream))
+		acks[owner][pdu->header.stream] = pdu->header.ack_num;
+}
+
+// Indique si une lecture s'est terminée depuis le compte reads.
+static int ack_read(void* reads)
+{
+	return __atomic_load_n(&ack_reads, __ATOMIC_ACQUIRE) != *(unsigned long*)reads;
+}
+
+// Attend le prochain PDU reçu par le client, jusqu'à deadline (µs) au plus (ack_lock tenu). Le
+// premier thread en attente lit le socket système et remet le PDU à son
+// destinataire, les autres sont réveillés après chaque PDU reçu ou délai expiré ; avec le
+// simulateur, l'échéance est en temps virtuel.
+static void await_pdu(int socket, unsigned long deadline)
+{
+	if (!ack_reading)
+	{
+		ack_reading = 1;
+		pthread_mutex_unlock(&ack_lock);
+		char payload[HANDSHAKE_SIZE + TOKEN_SIZE];
+		mic_tcp_pdu pdu = { .payload = { .data = payload, .size = sizeof(payload) } };
+		mic_tcp_sock_addr from;
+		const unsigned long now = get_now_time_usec();
+		const int received = IP_recv(&pdu, &from, deadline > now ? (deadline - now + 999) / 1000 : 0);
+		pthread_mutex_lock(&ack_lock);
+		ack_reading = 0;
+		if (received >= 0)
+			deliver_pdu(&pdu, received);
+		pthread_cond_broadcast(&ack_cond);
+		if (mictcp_sim_enabled())
+		{
+			__atomic_add_fetch(&ack_reads, 1, __ATOMIC_RELEASE);
+			mictcp_sim_notify();
+		}
+	}
+	// En simulation, les autres émetteurs attendent dans le simulateur : bloqués sur ack_cond,
+	// ils empêcheraient le temps virtuel d'avancer jusqu'au PDU attendu par le lecteur.
+	else if (mictcp_sim_enabled())
+	{
+		unsigned long reads = __atomic_load_n(&ack_reads, __ATOMIC_ACQUIRE);
+		pthread_mutex_unlock(&ack_lock);
+		mictcp_sim_wait(ack_read, &reads);
+		pthread_mutex_lock(&ack_lock);
+	}
+	else
+	{
+		struct timespec until;
+		const unsigned long now = get_now_time_usec();
+		mictcp_clock_deadline(&until, deadline > now ? deadline - now : 0);
+		pthread_cond_timedwait(&ack_cond, &ack_lock, &until);
+	}
+}
+
+// Attend le ACK ack_num d'un flux pendant timeout ms au plus. Un flux qui attend un renvoi ne
+// bloque pas les autres, ni les autres connexions du processus (voir await_pdu).
+// Retourne 0 si le ACK est reçu, -1 sinon.
+static int wait_ack(int socket, int stream, unsigned int ack_num, unsigned long timeout)
+{
+	const unsigned long deadline = get_now_time_usec() + timeout * 1000;
+	int result = -1;
+	pthread_mutex_lock(&ack_lock);
+	while (acks[socket][stream] != ack_num && resuming[socket] != RESUME_REFUSED && sockets[socket].state != CLOSE_WAIT
+		&& get_now_time_usec() < deadline)
+		await_pdu(socket, deadline);
+	if (acks[socket][stream] == ack_num)
+	{
+		acks[socket][stream] = UINT_MAX;
+		result = 0;
+	}
+	pthread_mutex_unlock(&ack_lock);
+	return result;
+}
+
+// Attend le SYN ACK d'une poignée de main pendant timeout ms au plus, et le copie dans pdu.
+// Retourne la taille de sa charge utile, -1 si aucun n'est reçu.
+static int wait_syn_ack(int socket, mic_tcp_pdu* pdu, unsigned long timeout)
+{
+	const unsigned long deadline = get_now_time_usec() + timeout * 1000;
+	int result = -1;
+	pthread_mutex_lock(&ack_lock);
+	while (syn_ack_sizes[socket] < 0 && get_now_time_usec() < deadline)
+		await_pdu(socket, deadline);
+	if (syn_ack_sizes[socket] >= 0)
+	{
+		result = syn_ack_sizes[socket] < pdu->payload.size ? syn_ack_sizes[socket] : pdu->payload.size;
+		pdu->header = syn_ack_headers[socket];
+		memcpy(pdu->payload.data, syn_ack_payloads[socket], result);
+		pdu->payload.size = result;
+		syn_ack_sizes[socket] = -1;
+	}
+	pthread_mutex_unlock(&ack_lock);
+	return result;
+}
+
+// Indique si un socket d'écoute a une connexion établie à remettre, ou a été fermé.
+static int is_acceptable(void* socket)
+{
+	const int listener = *(int*)socket;
+	return __atomic_load_n(&accept_count[listener], __ATOMIC_ACQUIRE) > 0 || sockets[listener].state != LISTEN;
+}
+
+// Indique si un socket est libre : fermé, ou sorti de l'état TIME_WAIT.
+static int is_free(int socket)
+{
+	if (sockets[socket].state == TIME_WAIT && get_now_time_usec() >= time_wait_deadline[socket])
+		set_state(socket, CLOSED);
+	return sockets[socket].state == CLOSED;
+}
+
+// Initialise un socket : état IDLE, options par défaut, flux et statistiques remis à zéro.
+static void init_socket(int d, start_mode sm)
+{
+	sockets[d].fd = d;
+	sockets[d].addr.ip_addr = NULL;
+	sockets[d].addr.ip_addr_size = 0;
+	sockets[d].addr.port = 0;
+	modes[d] = sm;
+	set_state(d, IDLE);
+	// Initialisation des flux : numéros de séquence, distances de perte et fiabilités proposées.
+	int k;
+	for (k = 0; k < MICTCP_STREAMS; k++)
+	{
+		seq[d][k] = MICTCP_INITIAL_SEQ;
+		loss_distance_max[d][k] = 0;
+		loss_distance[d][k] = 0;
+		proposals[d][k] = -1;
+		acks[d][k] = UINT_MAX;
+		segments[d][k].size = 0;
+		segments_discarded[d][k] = 0;
+		corks[d][k].size = 0;
+		corks_count[d][k] = 0;
+		corks_deadline[d][k] = 0;
+	}
+	pacer_stamp[d] = 0;
+	resuming[d] = 0;
+	resumed_nonce[d] = 0;
+	syn_ack_sizes[d] = -1;
+	sending[d] = 0;
+	eof[d] = 0;
+	parents[d] = -1;
+	accept_head[d] = 0;
+	accept_count[d] = 0;
+	half_open[d] = 0;
+	// Données d'une connexion précédente jamais lues.
+	if (sm == SERVER)
+		app_buffer_clear(d);
+	// Remise à zéro des statistiques.
+	memset(&stats[d], 0, sizeof(mic_tcp_stats));
+	// Options par défaut.
+	memcpy(options[d], default_options, sizeof(default_options));
+	STAT_SET(d, window, options[d][OPT_WINDOW]);
+	mss[d] = options[d][OPT_MSS];
+	compression[d] = 0;
+	int l;
+	for (l = 0; l < LATENCIES; l++)
+		mictcp_hist_reset(&latencies[d][l]);
+}
+
+// Réserve un descripteur libre, pour l'application ou pour une connexion d'un socket d'écoute.
+// Retourne le descripteur, ou -1 si tous sont occupés.
+static int claim_socket(start_mode sm)
+{
+	int d;
+	pthread_mutex_lock(&socket_lock);
+	// Recherche d'un descripteur libre.
+	for (d = 0; d < socketd; d++)
+		if (is_free(d))
+			break;
+	// Si aucun descripteur disponible, on en créer un.
+	if (d == socketd && socketd < MICTCP_SOCKETS)
+		socketd++;
+	if (d < MICTCP_SOCKETS)
+		init_socket(d, sm);
+	else
+		d = -1;
+	pthread_mutex_unlock(&socket_lock);
+	return d;
+}
 
 /*
  * Permet de créer un socket entre l’application et MIC-TCP
@@ -57,29 +706,10 @@ static unsigned int loss_distance_max_from_reliability(char reliability)
 int mic_tcp_socket(start_mode sm)
 {
 	MICTCP_DEBUG_FUNCTION;
-	set_loss_rate(MICTCP_LOSS_RATE);
+	pthread_once(&options_once, load_options);
+	pthread_once(&ack_once, init_ack_cond);
 	if (initialize_components(sm) == -1) return -1;
-	// Recherche d'un descripteur libre.
-	int d;
-	for (d = 0; d < socketd; d++)
-		if (sockets[d].state == CLOSED)
-			break;
-	// Si aucun descripteur disponible, on en créer un.
-	if (d == socketd)
-	{
-		socketd++;
-		if (socketd >= MICTCP_SOCKETS)
-			return -1;
-	}
-	// Initialisation du socket.
-	sockets[d].fd = d;
-	sockets[d].state = IDLE;
-	// Initialisation des numéros de séquence.
-	seq[d] = MICTCP_INITIAL_SEQ;
-	// Initialisation des distances de perte.
-	loss_distance_max[d] = 0; 
-	loss_distance[d] = 0;
-	return d;
+	return claim_socket(sm);
 }
 
 /*
@@ -98,298 +728,1358 @@ int mic_tcp_bind(int socket, mic_tcp_sock_addr addr)
 }
 
 /*
- * Met le socket en état d'acceptation de connexions
- * Retourne 0 si succès, -1 si erreur
+ * Met un socket serveur en écoute sur son port : le thread d'écoute établit ses connexions,
+ * chacune sur un nouveau socket, et en garde jusqu'à OPT_BACKLOG en attente de mic_tcp_accept.
+ * Au-delà, il répond aux SYN par des SYN cookies, sans rien garder.
+ * Retourne 0 si succès, -1 si erreur
+ */
+int mic_tcp_listen(int socket)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || modes[socket] != SERVER || sockets[socket].state != IDLE)
+		return -1;
+	set_state(socket, LISTEN);
+	return 0;
+}
+
+/*
+ * Retire la plus ancienne connexion établie de la file d'un socket d'écoute (mis en écoute
+ * au premier appel), en l'attendant si la file est vide.
+ * Retourne le descripteur du socket de la connexion, -1 si erreur
+ * NB : la poignée de main est traitée par le thread d'écoute, dans
+ * process_received_PDU(), seul lecteur du socket système côté serveur.
+ */
+int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || (sockets[socket].state != LISTEN && mic_tcp_listen(socket) == -1))
+		return -1;
+	int connection = -1;
+	while (connection == -1 && sockets[socket].state == LISTEN)
+	{
+		wait_event(is_acceptable, &socket);
+		pthread_mutex_lock(&accept_lock);
+		if (accept_count[socket] > 0)
+		{
+			connection = accept_queue[socket][accept_head[socket]];
+			accept_head[socket] = (accept_head[socket] + 1) % MICTCP_SOCKETS;
+			accept_count[socket]--;
+			parents[connection] = -1;
+		}
+		pthread_mutex_unlock(&accept_lock);
+	}
+	if (connection >= 0 && addr != NULL)
+		*addr = connections[connection];
+	return connection;
+}
+
+// Propositions de fiabilité partielle des flux d'un socket (OPT_RELIABILITY par défaut).
+static void make_proposal(int socket, char* proposal)
+{
+	int k;
+	for (k = 0; k < MICTCP_STREAMS; k++)
+	{
+		proposal[k] = proposals[socket][k] >= 0 ? proposals[socket][k] : options[socket][OPT_RELIABILITY];
+		#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
+			MICTCP_LOG(MICTCP_LOG_DEBUG, "Setting reliability proposal of stream %d to %u%c...", k, proposal[k], '%');
+		#endif
+	}
+}
+
+// Applique les paramètres négociés d'une connexion : fiabilités partielles des flux, MSS et compression.
+static void apply_parameters(int socket, const char* values, int size, int compress)
+{
+	int k;
+	for (k = 0; k < MICTCP_STREAMS; k++)
+	{
+		reliabilities[socket][k] = values[k];
+		loss_distance_max[socket][k] = loss_distance_max_from_reliability(socket, values[k]);
+		#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
+			MICTCP_LOG(MICTCP_LOG_DEBUG, "Confirmed reliability of stream %d to %u%c (loss distance : %u).", k, values[k], '%', loss_distance_max[socket][k]);
+		#endif
+	}
+	mss[socket] = size;
+	compression[socket] = compress;
+}
+
+// Applique les paramètres du jeton de reprise d'un socket client, s'ils correspondent à ses
+// propositions et à ses options. Retourne 1 si la connexion peut être reprise, 0 sinon.
+static int resume_parameters(int socket, const char* proposal)
+{
+	mic_tcp_pdu view = token_parameters(tokens[socket]);
+	const int size = import_mss(&view, INT_MAX), compress = import_compression(&view, 1);
+	if (memcmp(view.payload.data, proposal, MICTCP_STREAMS) != 0 || size > options[socket][OPT_MSS]
+		|| (compress && !options[socket][OPT_COMPRESS]))
+		return 0;
+	apply_parameters(socket, proposal, size, compress);
+	return 1;
+}
+
+// Poignée de main complète avec addr (SYN, SYN ACK, ACK), en OPT_RETRIES tentatives au plus.
+// Le SYN ACK peut porter un jeton de reprise, gardé pour la connexion suivante, ou un SYN
+// cookie : le serveur n'a alors rien gardé, et le premier PDU de données présentera le cookie
+// à la place du ACK.
+// Retourne 0 si la connexion est établie, 1 si elle le sera par le cookie, -1 sinon.
+static int handshake(int socket, mic_tcp_sock_addr addr, const char* proposal)
+{
+	mic_tcp_pdu pdu = {
+		.header = {
+			.source_port = sockets[socket].addr.port,
+			.dest_port = addr.port,
+			.seq_num = seq[socket][0],
+			.ack_num = UINT_MAX,
+			.syn = 1,
+			.ack = 0,
+			.fin = 0
+		},
+		.payload.size = 0
+	}, pdu_ack = {0};
+	char answer[HANDSHAKE_SIZE + TOKEN_SIZE];
+	export_reliability(&pdu, proposal);
+	export_mss(&pdu, options[socket][OPT_MSS]);
+	export_compression(&pdu, options[socket][OPT_COMPRESS]);
+	pdu_ack.payload.data = answer;
+	// Mise à jour du numéro de séquence (la poignée de main utilise le flux 0).
+	seq[socket][0] = (seq[socket][0] + 1) % 2;
+	int tries = 0, result = -1, k;
+	do
+	{
+		// Envoi du SYN.
+		result = IP_send(pdu, addr);
+		STAT_ADD(socket, pdus_sent, 1);
+		// Attente du SYN ACK.
+		if (result >= 0)
+		{
+			pdu_ack.payload.size = sizeof(answer);
+			result = wait_syn_ack(socket, &pdu_ack, options[socket][OPT_TIMEOUT_CONNECT]);
+			if (result >= 0)
+			{
+				for (k = 0; k < MICTCP_STREAMS && import_reliability(&pdu_ack, k) == proposal[k]; k++);
+				if (pdu_ack.header.ack_num == seq[socket][0] && k == MICTCP_STREAMS)
+				{
+					// Application des valeurs finales de fiabilité partielle, de la MSS
+					// et de la compression retenues par le serveur.
+					apply_parameters(socket, proposal, import_mss(&pdu_ack, options[socket][OPT_MSS]),
+						import_compression(&pdu_ack, options[socket][OPT_COMPRESS]));
+					const int cookie = pdu_ack.payload.size == (int)sizeof(answer)
+						&& (unsigned char)answer[HANDSHAKE_SIZE] == COOKIE_MAGIC;
+					if (cookie)
+					{
+						// Le serveur ne connaît pas encore la connexion : les flux repartent
+						// de leur numéro de séquence initial.
+						memcpy(tokens[socket], answer + HANDSHAKE_SIZE, TOKEN_SIZE);
+						for (k = 0; k < MICTCP_STREAMS; k++)
+							seq[socket][k] = MICTCP_INITIAL_SEQ;
+					}
+					else
+					{
+						if (options[socket][OPT_RESUME] && pdu_ack.payload.size == (int)sizeof(answer))
+							resume_store(addr, (unsigned char*)answer + HANDSHAKE_SIZE);
+						// Envoi du ACK.
+						pdu.header.seq_num = seq[socket][0];
+						pdu.header.ack_num = seq[socket][0];
+						pdu.header.syn = 0;
+						pdu.header.ack = 1;
+						do result = IP_send(pdu, addr);
+						while (result < 0);
+						STAT_ADD(socket, pdus_sent, 1);
+					}
+					// Connexion établie.
+					connections[socket] = addr;
+					set_state(socket, ESTABLISHED);
+					#ifdef MICTCP_DEBUG_CONNECTION
+						MICTCP_LOG(MICTCP_LOG_DEBUG, cookie ? "SYN cookie received." : "Connection established.");
+					#endif
+					result = cookie;
+				}
+				else
+				{
+					MICTCP_LOG(MICTCP_LOG_WARN, "Connection refused.");
+					result = -1;
+				}
+			}
+		}
+	}
+	while (result < 0 && ++tries < options[socket][OPT_RETRIES]);
+	free(pdu.payload.data);
+	return result < 0 ? -1 : result;
+}
+
+// Attribue un port libre à un socket client non lié : le serveur distingue ses connexions
+// par les ports de l'en-tête.
+static void bind_ephemeral(int socket)
+{
+	int s;
+	pthread_mutex_lock(&socket_lock);
+	if (ephemeral_port == 0)
+		ephemeral_port = EPHEMERAL_MIN + getpid() % (65536 - EPHEMERAL_MIN);
+	do
+	{
+		ephemeral_port = ephemeral_port == 65535 ? EPHEMERAL_MIN : ephemeral_port + 1;
+		for (s = 0; s < socketd && (s == socket || modes[s] != CLIENT || sockets[s].addr.port != ephemeral_port); s++);
+	}
+	while (s < socketd);
+	sockets[socket].addr.port = ephemeral_port;
+	pthread_mutex_unlock(&socket_lock);
+}
+
+/*
+ * Permet de réclamer l’établissement d’une connexion
+ * Avec OPT_RESUME et un jeton gardé d'une connexion précédente au même serveur, aux
+ * mêmes paramètres, la connexion est établie sans échange : le jeton part avec le
+ * premier PDU de données (et, s'il est refusé, une poignée de main complète le suit).
+ * Retourne 0 si la connexion est établie, et -1 en cas d’échec
+ */
+int mic_tcp_connect(int socket, mic_tcp_sock_addr addr)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket >= 0 && socket < socketd && sockets[socket].state == IDLE)
+	{
+		const unsigned long started_at = get_now_time_usec();
+		if (sockets[socket].addr.port == 0)
+			bind_ephemeral(socket);
+		// Proposition des pourcentages de fiabilité partielle des flux.
+		char proposal[MICTCP_STREAMS];
+		make_proposal(socket, proposal);
+		if (options[socket][OPT_RESUME] && resume_take(addr, tokens[socket]) && resume_parameters(socket, proposal))
+		{
+			connections[socket] = addr;
+			resuming[socket] = RESUME_PENDING;
+			set_state(socket, ESTABLISHED);
+			#ifdef MICTCP_DEBUG_CONNECTION
+				MICTCP_LOG(MICTCP_LOG_DEBUG, "Connection resumed.");
+			#endif
+		}
+		else
+		{
+			connections[socket] = addr;
+			set_state(socket, SYN_SENT);
+			const int result = handshake(socket, addr, proposal);
+			if (result == -1)
+				return -1;
+			// SYN cookie : il part avec le premier PDU de données, comme un jeton de reprise.
+			if (result == 1)
+				resuming[socket] = RESUME_PENDING;
+		}
+		mictcp_hist_record(&latencies[socket][LATENCY_CONNECT], get_now_time_usec() - started_at);
+		return 0;
+	}
+	return -1;
+}
+
+// Après le refus du jeton de reprise d'un socket client, établit la connexion par une poignée
+// de main complète et libère les flux en attente. Retourne 0 si la connexion est établie, 1 si
+// le serveur a répondu par un SYN cookie (à présenter par le PDU en cours, les autres flux
+// attendent toujours), -1 sinon (le socket revient à l'état IDLE).
+static int resume_fallback(int socket)
+{
+	char proposal[MICTCP_STREAMS];
+	int k;
+	MICTCP_LOG(MICTCP_LOG_INFO, "[MIC-TCP] Jeton de reprise refusé, poignée de main complète.");
+	for (k = 0; k < MICTCP_STREAMS; k++)
+		seq[socket][k] = MICTCP_INITIAL_SEQ;
+	make_proposal(socket, proposal);
+	set_state(socket, SYN_SENT);
+	const int result = handshake(socket, connections[socket], proposal);
+	if (result == -1)
+		set_state(socket, IDLE);
+	pthread_mutex_lock(&ack_lock);
+	resuming[socket] = result == 1 ? RESUME_IN_FLIGHT : 0;
+	pthread_cond_broadcast(&ack_cond);
+	pthread_mutex_unlock(&ack_lock);
+	return result;
+}
+
+// Retire size octets du seau à jetons d'un socket, rempli à OPT_PACING_RATE octets/s dans la
+// limite de OPT_PACING_BURST, puis attend que le seau ne soit plus à découvert. Les flux d'un
+// socket partagent le seau : leurs PDU partent espacés au lieu de partir d'affilée.
+static void pace(int socket, int size)
+{
+	const long long rate = options[socket][OPT_PACING_RATE], burst = (long long)options[socket][OPT_PACING_BURST] * 1000000;
+	if (rate == 0)
+		return;
+	pthread_mutex_lock(&pacer_locks[socket]);
+	const unsigned long now = get_now_time_usec();
+	const unsigned long elapsed = now - pacer_stamp[socket];
+	if (pacer_stamp[socket] == 0 || elapsed >= (unsigned long)((burst - pacer_credit[socket]) / rate))
+		pacer_credit[socket] = burst;
+	else
+		pacer_credit[socket] += (long long)elapsed * rate;
+	pacer_stamp[socket] = now;
+	pacer_credit[socket] -= (long long)size * 1000000;
+	// L'attente rembourse le découvert : les envois suivants le voient déjà compté.
+	const unsigned long wait = pacer_credit[socket] < 0 ? (unsigned long)((-pacer_credit[socket] + rate - 1) / rate) : 0;
+	pthread_mutex_unlock(&pacer_locks[socket]);
+	if (wait > 0)
+	{
+		STAT_ADD(socket, pacing_delay, wait);
+		sleep_usec(wait);
+	}
+}
+
+// Agrandit les tampons du socket UDP au double du produit débit-délai d'une émission lissée,
+// pour qu'une rafale d'un RTT tienne dans les tampons des deux extrémités.
+static void size_buffers(int socket)
+{
+	const unsigned long rate = options[socket][OPT_PACING_RATE];
+	const unsigned long rtt = STAT_GET(socket, rtt_avg) + 4 * STAT_GET(socket, rtt_var);
+	if (rate > 0)
+		set_socket_buffers(2 * (rate * rtt / 1000000));
+}
+
+// Envoie un segment d'un message sur un flux, jusqu'à son acquittement ou une perte admise
+// (jamais si reliable). flags peut contenir MICTCP_FLAG_MORE (d'autres segments du message
+// suivent) et MICTCP_FLAG_BATCH (la charge utile regroupe plusieurs messages).
+// Retourne 0 si succès, -1 si la connexion reprise n'a pu être établie.
+static int send_segment(int socket, int stream, char* data, int size, int flags, int reliable)
+{
+	// Connexion reprise (ou SYN cookie) : le premier PDU de données porte le jeton (SYN), les
+	// autres flux attendent son acquittement.
+	int carrier = 0;
+	if (__atomic_load_n(&resuming[socket], __ATOMIC_ACQUIRE) != 0)
+	{
+		pthread_mutex_lock(&ack_lock);
+		while (resuming[socket] == RESUME_IN_FLIGHT || resuming[socket] == RESUME_REFUSED)
+			pthread_cond_wait(&ack_cond, &ack_lock);
+		if (resuming[socket] == RESUME_PENDING)
+		{
+			resuming[socket] = RESUME_IN_FLIGHT;
+			carrier = 1;
+		}
+		pthread_mutex_unlock(&ack_lock);
+		if (sockets[socket].state != ESTABLISHED)
+			return -1;
+	}
+	// Compression de la charge utile, sauf si elle paraît incompressible (vidéo, etc.) ;
+	// elle n'est gardée que si elle économise au moins 1/16 de la taille.
+	char packed[compression[socket] ? size + 1 : 1];
+	if (compression[socket] && size >= MICTCP_COMPRESS_MIN && mictcp_lz4_entropy(data, size) < MICTCP_COMPRESS_ENTROPY)
+	{
+		const int packed_size = mictcp_lz4_compress(data, size, packed, size - size / 16);
+		if (packed_size > 0)
+		{
+			STAT_ADD(socket, bytes_saved, size - packed_size);
+			data = packed;
+			size = packed_size;
+			flags |= MICTCP_FLAG_LZ4;
+		}
+	}
+	char first[carrier ? TOKEN_SIZE + size : 1];
+	if (carrier)
+	{
+		memcpy(first, tokens[socket], TOKEN_SIZE);
+		memcpy(first + TOKEN_SIZE, data, size);
+	}
+	mic_tcp_pdu pdu = {
+		.header = {
+			.source_port = sockets[socket].addr.port,
+			.dest_port = connections[socket].port,
+			.seq_num = seq[socket][stream],
+			.ack_num = UINT_MAX,
+			.syn = carrier,
+			.ack = 0,
+			.fin = 0,
+			.more = (flags & MICTCP_FLAG_MORE) != 0,
+			.batch = (flags & MICTCP_FLAG_BATCH) != 0,
+			.compressed = (flags & MICTCP_FLAG_LZ4) != 0,
+			.stream = stream
+		},
+		.payload = {
+			.data = carrier ? first : data,
+			.size = carrier ? TOKEN_SIZE + size : size
+		}
+	};
+	// Mise à jour du numéro de séquence.
+	seq[socket][stream] = (seq[socket][stream] + 1) % 2;
+	// Mise à jour des pertes.
+	loss_distance[socket][stream]++;
+	// Le PDU porteur du jeton établit la connexion du serveur : il doit arriver.
+	reliable |= carrier;
+	int result = -1, resend = 1, perte = 0, tries = 0;
+	do
+	{
+		// Envoi du PDU, renvois compris, au rythme du lissage.
+		pace(socket, pdu.payload.size + API_HD_Size);
+		const unsigned long sent_at = get_now_time_usec();
+		result = IP_send(pdu, connections[socket]);
+		STAT_ADD(socket, pdus_sent, 1);
+		STAT_ADD(socket, bytes_sent, size);
+		if (tries++ > 0)
+		{
+			STAT_ADD(socket, retransmits, 1);
+			MICTCP_TRACE(TRACE_RETRANSMIT, socket, &pdu.header, size, tries - 1);
+		}
+		if (result == pdu.payload.size)
+		{
+			// Attente du ACK : si la séquence correspond, arrêt.
+			if (wait_ack(socket, stream, seq[socket][stream], ack_timeout(socket, tries)) == 0)
+			{
+				resend = 0;
+				// Sans OPT_RESUME, le serveur acquitte le cookie sans délivrer de jeton.
+				if (carrier && __atomic_load_n(&resuming[socket], __ATOMIC_ACQUIRE) == RESUME_IN_FLIGHT)
+				{
+					pthread_mutex_lock(&ack_lock);
+					resuming[socket] = 0;
+					pthread_cond_broadcast(&ack_cond);
+					pthread_mutex_unlock(&ack_lock);
+				}
+				const mic_tcp_header ack_header = { .ack = 1, .ack_num = seq[socket][stream], .seq_num = UINT_MAX, .stream = stream };
+				MICTCP_TRACE(TRACE_ACK, socket, &ack_header, 0, get_now_time_usec() - sent_at);
+				// Seuls les PDU non renvoyés donnent une mesure de RTT fiable.
+				if (tries == 1)
+				{
+					pthread_mutex_lock(&ack_lock);
+					update_rtt(socket, get_now_time_usec() - sent_at);
+					pthread_mutex_unlock(&ack_lock);
+					size_buffers(socket);
+				}
+			}
+			// Connexion fermée par le serveur : le message ne sera pas remis.
+			else if (sockets[socket].state == CLOSE_WAIT)
+				return -1;
+			// Jeton refusé : poignée de main complète, puis renvoi du PDU sans jeton (ou avec le
+			// SYN cookie de cette poignée de main).
+			else if (carrier && __atomic_load_n(&resuming[socket], __ATOMIC_ACQUIRE) == RESUME_REFUSED)
+			{
+				carrier = resume_fallback(socket);
+				if (carrier == -1)
+					return -1;
+				tries = 0;
+				pdu.header.syn = carrier;
+				pdu.header.seq_num = seq[socket][stream];
+				if (carrier)
+					memcpy(first, tokens[socket], TOKEN_SIZE);
+				else
+				{
+					pdu.payload.data = data;
+					pdu.payload.size = size;
+				}
+				seq[socket][stream] = (seq[socket][stream] + 1) % 2;
+			}
+			// Sinon, on enregistre une perte.
+			else
+			{
+				// Si c'est la première perte pour ce paquet, on défini si on doit le renvoyer.
+				if (perte == 0)
+				{
+					perte = 1;
+					// Si la perte n'est pas admissible, on réinitialise la distance de perte.
+					if (reliable || loss_distance[socket][stream] > loss_distance_max[socket][stream])
+						loss_distance[socket][stream] = 0;
+					// Sinon, on l'ignore.
+					else resend = 0;
+				}
+				#ifdef MICTCP_DEBUG_LOSS
+					MICTCP_LOG(MICTCP_LOG_DEBUG, "Lost packet #%d (stream %d) %s.", pdu.header.seq_num, stream, resend == 0 ? "ignored" : "resent");
+				#endif
+				STAT_ADD(socket, losses, 1);
+				MICTCP_TRACE(TRACE_LOSS, socket, &pdu.header, size, !resend);
+				if (!resend)
+					STAT_ADD(socket, losses_ignored, 1);
+			}
+		}
+	}
+	while (resend == 1);
+	return 0;
+}
+
+// Envoie les messages en attente d'un flux (verrou du flux tenu) : un message seul part
+// tel quel, plusieurs partent dans un même PDU marqué MICTCP_FLAG_BATCH.
+// Retourne 0 si succès, -1 si la connexion est perdue (messages non remis).
+static int cork_flush(int socket, int stream)
+{
+	mic_tcp_payload* cork = &corks[socket][stream];
+	int result;
+	if (cork->size == 0)
+		return 0;
+	if (corks_count[socket][stream] == 1)
+		result = send_segment(socket, stream, cork->data + 2, cork->size - 2, 0, 0);
+	else
+	{
+		result = send_segment(socket, stream, cork->data, cork->size, MICTCP_FLAG_BATCH, 0);
+		STAT_ADD(socket, batched, corks_count[socket][stream]);
+	}
+	// Même en cas d'échec : la connexion est perdue, les messages ne seront pas remis.
+	cork->size = 0;
+	corks_count[socket][stream] = 0;
+	__atomic_store_n(&corks_deadline[socket][stream], 0, __ATOMIC_RELAXED);
+	return result;
+}
+
+// Envoie les regroupements dont l'échéance est passée, et attend la prochaine échéance.
+static void* cork_flusher(void* arg)
+{
+	struct timespec ts;
+	pthread_mutex_lock(&flusher_lock);
+	while (1)
+	{
+		unsigned long next = 0;
+		int s, k;
+		for (s = 0; s < socketd; s++)
+			for (k = 0; k < MICTCP_STREAMS; k++)
+			{
+				const unsigned long deadline = __atomic_load_n(&corks_deadline[s][k], __ATOMIC_RELAXED);
+				if (deadline != 0 && (next == 0 || deadline < next))
+					next = deadline;
+			}
+		const unsigned long now = get_now_time_usec();
+		if (next == 0)
+			pthread_cond_wait(&flusher_cond, &flusher_lock);
+		else if (next > now)
+		{
+			// Échéance relative : l'horloge du protocole peut être le TSC.
+			mictcp_clock_deadline(&ts, next - now);
+			pthread_cond_timedwait(&flusher_cond, &flusher_lock, &ts);
+		}
+		else
+		{
+			pthread_mutex_unlock(&flusher_lock);
+			for (s = 0; s < socketd; s++)
+				for (k = 0; k < MICTCP_STREAMS; k++)
+				{
+					const unsigned long deadline = __atomic_load_n(&corks_deadline[s][k], __ATOMIC_RELAXED);
+					if (deadline == 0 || deadline > now)
+						continue;
+					pthread_mutex_lock(&cork_locks[s][k]);
+					// L'application a pu vider le flux entre-temps.
+					if (corks_deadline[s][k] != 0 && corks_deadline[s][k] <= now && sockets[s].state == ESTABLISHED)
+					{
+						set_thread_side(modes[s]);
+						if (cork_flush(s, k) == -1)
+							MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] Regroupement du flux %d du socket %d perdu, connexion fermée.", k, s);
+					}
+					pthread_mutex_unlock(&cork_locks[s][k]);
+				}
+			pthread_mutex_lock(&flusher_lock);
+		}
+	}
+	return NULL;
+}
+
+static void start_flusher(void)
+{
+	pthread_condattr_t attr;
+	pthread_t th;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&flusher_cond, &attr);
+	pthread_condattr_destroy(&attr);
+	pthread_create(&th, NULL, cork_flusher, NULL);
+	pthread_detach(th);
+}
+
+// Ajoute un petit message aux messages en attente d'un flux (verrou du flux tenu). Le
+// regroupement part quand il est plein, ou OPT_CORK_DELAY ms après son premier message.
+// Retourne 0 si succès, et -1 soit si le message n'a pu être mis en attente (mémoire
+// épuisée), soit si un regroupement envoyé n'a pu être remis : dans ce dernier cas, les
+// messages regroupés avant lui sont perdus mais celui-ci reste bien en attente.
+static int cork_append(int socket, int stream, char* mesg, int size)
+{
+	mic_tcp_payload* cork = &corks[socket][stream];
+	int result = 0;
+	if (cork->size + 2 + size > mss[socket])
+		result = cork_flush(socket, stream);
+	if (corks_capacity[socket][stream] < mss[socket])
+	{
+		char* data = realloc(cork->data, mss[socket]);
+		if (data == NULL)
+			return -1;
+		cork->data = data;
+		corks_capacity[socket][stream] = mss[socket];
+	}
+	cork->data[cork->size] = (char)(size >> 8);
+	cork->data[cork->size + 1] = (char)(size & 0xff);
+	memcpy(cork->data + cork->size + 2, mesg, size);
+	cork->size += 2 + size;
+	corks_count[socket][stream]++;
+	// Plus de place pour un autre message : envoi immédiat.
+	if (cork->size + 2 > mss[socket])
+	{
+		if (cork_flush(socket, stream) == -1)
+			result = -1;
+	}
+	// Premier message du regroupement : armement de l'échéance (sans objet en simulation,
+	// où seuls le remplissage, mic_tcp_flush et mic_tcp_close vident le regroupement).
+	else if (corks_count[socket][stream] == 1 && !mictcp_sim_enabled())
+	{
+		pthread_once(&flusher_once, start_flusher);
+		__atomic_store_n(&corks_deadline[socket][stream],
+			get_now_time_usec() + (unsigned long)options[socket][OPT_CORK_DELAY] * 1000, __ATOMIC_RELAXED);
+		pthread_mutex_lock(&flusher_lock);
+		pthread_cond_signal(&flusher_cond);
+		pthread_mutex_unlock(&flusher_lock);
+	}
+	return result;
+}
+
+/*
+ * Permet de réclamer l’envoi d’une donnée applicative
+ * Retourne la taille des données envoyées, et -1 en cas d'erreur
+ */
+int mic_tcp_send (int socket, char* mesg, int mesg_size)
+{
+	return mic_tcp_send_stream(socket, 0, mesg, mesg_size);
+}
+
+// Envoie un message sur un flux d'une connexion établie, en segments au plus grands de la MSS,
+// ou l'ajoute aux petits messages en attente (OPT_CORK).
+// Retourne la taille du message, et -1 si la connexion est perdue.
+static int send_message(int socket, int stream, char* mesg, int mesg_size)
+{
+	if (options[socket][OPT_CORK])
+	{
+		pthread_mutex_lock(&cork_locks[socket][stream]);
+		if (mesg_size + 2 <= mss[socket])
+		{
+			const int result = cork_append(socket, stream, mesg, mesg_size);
+			pthread_mutex_unlock(&cork_locks[socket][stream]);
+			return result == -1 ? -1 : mesg_size;
+		}
+		// Un grand message part seul, après les messages en attente.
+		const int result = cork_flush(socket, stream);
+		pthread_mutex_unlock(&cork_locks[socket][stream]);
+		if (result == -1)
+			return -1;
+	}
+	const unsigned long started_at = get_now_time_usec();
+	// Un message découpé est entièrement fiabilisé : un segment manquant perdrait tout le message.
+	const int reliable = mesg_size > mss[socket];
+	int offset = 0;
+	do
+	{
+		const int size = mesg_size - offset < mss[socket] ? mesg_size - offset : mss[socket];
+		if (send_segment(socket, stream, mesg + offset, size, offset + size < mesg_size ? MICTCP_FLAG_MORE : 0, reliable) == -1)
+			return -1;
+		offset += size;
+	}
+	while (offset < mesg_size);
+	mictcp_hist_record(&latencies[socket][LATENCY_ACK], get_now_time_usec() - started_at);
+	return mesg_size;
+}
+
+/*
+ * Envoi d'une donnée applicative sur un flux de la connexion : chaque flux est
+ * ordonné et fiabilisé indépendamment des autres, et plusieurs threads peuvent
+ * émettre en même temps sur des flux différents (un seul thread par flux).
+ * Un message plus grand que la MSS est découpé en segments, réassemblés par le
+ * récepteur avant d'être remis (MICTCP_MESSAGE_MAX octets au plus).
+ * Avec OPT_CORK, les petits messages sont regroupés dans un même PDU (voir mic_tcp_flush).
+ * Un message vide n'est pas envoyé : une réception de 0 octet signale la fin du flux.
+ * Retourne la taille des données envoyées, et -1 en cas d'erreur (connexion fermée
+ * par le serveur, notamment)
+ */
+int mic_tcp_send_stream(int socket, int stream, char* mesg, int mesg_size)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || !stream_valid(stream) || mesg_size < 0 || mesg_size > MICTCP_MESSAGE_MAX)
+		return -1;
+	// Le thread émetteur n'a pas forcément créé le socket : le côté vient du socket.
+	set_thread_side(modes[socket]);
+	// Compté avant le contrôle de l'état : mic_tcp_close attend la fin des envois commencés avant lui.
+	__atomic_add_fetch(&sending[socket], 1, __ATOMIC_SEQ_CST);
+	int result = -1;
+	if (__atomic_load_n(&sockets[socket].state, __ATOMIC_SEQ_CST) == ESTABLISHED)
+		result = mesg_size > 0 ? send_message(socket, stream, mesg, mesg_size) : 0;
+	if (__atomic_sub_fetch(&sending[socket], 1, __ATOMIC_SEQ_CST) == 0 && sockets[socket].state == CLOSING)
+	{
+		pthread_mutex_lock(&ack_lock);
+		pthread_cond_broadcast(&ack_cond);
+		pthread_mutex_unlock(&ack_lock);
+	}
+	return result;
+}
+
+/*
+ * Permet à l’application réceptrice de réclamer la récupération d’une donnée
+ * stockée dans les buffers de réception du socket
+ * Retourne le nombre d’octets lu ou bien -1 en cas d’erreur
+ * NB : cette fonction fait appel à la fonction app_buffer_get()
+ */
+int mic_tcp_recv (int socket, char* mesg, int max_mesg_size)
+{
+	return mic_tcp_recv_stream(socket, NULL, mesg, max_mesg_size);
+}
+
+// Indique si un socket peut recevoir : connexion établie, ou fermée par le client
+// (les données reçues avant son FIN restent à lire).
+static int is_readable(int socket)
+{ return socket >= 0 && socket < socketd && (sockets[socket].state == ESTABLISHED || sockets[socket].state == CLOSE_WAIT); }
+
+/*
+ * Comme mic_tcp_recv, et indique dans *stream (si non NULL) le flux de la donnée.
+ * Les données de tous les flux sont remises dans leur ordre d'arrivée.
+ * Retourne le nombre d’octets lu, 0 à la fin du flux (le client a fermé la
+ * connexion) ou bien -1 en cas d’erreur
+ */
+int mic_tcp_recv_stream(int socket, int* stream, char* mesg, int max_mesg_size)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (is_readable(socket))
+	{
+		if (eof[socket])
+			return 0;
+		mic_tcp_payload payload = {
+			.data = mesg,
+			.size = max_mesg_size
+		};
+		unsigned long received_at;
+		const int result = app_buffer_get_stream(socket, payload, &received_at, stream);
+		// Une donnée vide marque la fin du flux.
+		if (result == 0)
+			eof[socket] = 1;
+		else
+			mictcp_hist_record(&latencies[socket][LATENCY_DELIVERY], get_now_time_usec() - received_at);
+		return result;
+	}
+	return -1;
+}
+
+/*
+ * Comme mic_tcp_recv, mais récupère en un seul appel toutes les données en attente
+ * (count au plus, dans la limite de MICTCP_RECV_MANY_MAX) : mesgs[k].size donne la
+ * taille du buffer mesgs[k].data en entrée, et le nombre d'octets lus en sortie.
+ * Attend qu'au moins une donnée soit disponible.
+ * Retourne le nombre de messages lus, 0 à la fin du flux ou bien -1 en cas d'erreur
  */
-int mic_tcp_accept(int socket, mic_tcp_sock_addr* addr)
+int mic_tcp_recv_many(int socket, mic_tcp_payload* mesgs, int count)
 {
 	MICTCP_DEBUG_FUNCTION;
-	if (socket >= 0 && socket < socketd && sockets[socket].state == IDLE)
+	if (is_readable(socket) && mesgs != NULL && count > 0)
 	{
-		mic_tcp_pdu pdu = {
-			.header = {
-				.source_port = sockets[socket].addr.port,
-				.dest_port = addr->port,
-				.seq_num = UINT_MAX,
-				.ack_num = seq[socket],
-				.syn = 1,
-				.ack = 1,
-				.fin = 0
-			}
-		}, pdu_remote = {0};
-		prepare_for_reliability(&pdu_remote);
-		int result = -1;
-		do
+		if (eof[socket])
+			return 0;
+		unsigned long received_at[MICTCP_RECV_MANY_MAX];
+		int result = app_buffer_get_many(socket, mesgs, received_at, count < MICTCP_RECV_MANY_MAX ? count : MICTCP_RECV_MANY_MAX);
+		const unsigned long now = get_now_time_usec();
+		int k;
+		for (k = 0; k < result; k++)
 		{
-			sockets[socket].state = IDLE;
-			// Attente d'un SYN.
-			result = IP_recv(&pdu_remote, addr, MICTCP_TIMEOUT_CONNECT * MICTCP_RETRIES);
-			if (result >= 0 && pdu_remote.header.syn == 1)
+			// La fin du flux est toujours la dernière donnée.
+			if (mesgs[k].size == 0)
 			{
-				sockets[socket].state = SYN_RECEIVED;
-				// Récupération du pourcentage de fiabilité partielle.
-				const char reliability = import_reliability(&pdu_remote);
-				loss_distance_max[socket] = loss_distance_max_from_reliability(reliability);
-				#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
-					printf("Reliability set to %d%c (loss distance : %u).\n", reliability, '%', loss_distance_max[socket]);
-				#endif
-				// Définition du numéro de séquence.
-				pdu.header.seq_num = pdu_remote.header.seq_num;
-				pdu.header.ack_num = (pdu_remote.header.seq_num + 1) % 2;
-				seq[socket] = pdu.header.ack_num;
-				// Envoi du SYN ACK.
-				export_reliability(&pdu, reliability);
-				do
-				{
-					result = IP_send(pdu, *addr);
-					if (result == pdu.payload.size)
-					{
-						// Attente du ACK.
-						result = IP_recv(&pdu_remote, addr, MICTCP_TIMEOUT_ACK);
-						if (result >= 0)
-						{
-							if (pdu.header.ack == 1 && pdu.header.ack_num == seq[socket])
-							{
-								// Connexion établie.
-								connections[socket] = *addr;
-								sockets[socket].state = ESTABLISHED;
-								#ifdef MICTCP_DEBUG_CONNECTION
-									printf("Connection established.\n");
-								#endif
-								result = 0;
-							}
-							else
-							{
-								result = -1;
-								#ifdef MICTCP_DEBUG_REJECTED
-									printf("Packet #%d rejected.\n", pdu.header.ack_num);
-								#endif
-							}
-						}
-					}
-				}
-				while (result < 0);
-				free(pdu.payload.data);
+				eof[socket] = 1;
+				result = k;
+				break;
 			}
+			mictcp_hist_record(&latencies[socket][LATENCY_DELIVERY], now - received_at[k]);
 		}
-		while (result < 0);
-		free(pdu_remote.payload.data);
 		return result;
 	}
 	return -1;
 }
 
 /*
- * Permet de réclamer l’établissement d’une connexion
- * Retourne 0 si la connexion est établie, et -1 en cas d’échec
+ * Comme mic_tcp_recv_stream, mais sans copie : la donnée reste dans le tampon où
+ * elle a été reçue, prêté à l'application jusqu'à mic_tcp_release(socket, loan).
+ * Retourne le nombre d’octets reçus, 0 à la fin du flux (rien à rendre) ou bien
+ * -1 en cas d’erreur
  */
-int mic_tcp_connect(int socket, mic_tcp_sock_addr addr)
+int mic_tcp_recv_zc(int socket, mic_tcp_loan* loan)
 {
 	MICTCP_DEBUG_FUNCTION;
-	if (socket >= 0 && socket < socketd && sockets[socket].state == IDLE)
+	if (is_readable(socket) && loan != NULL)
 	{
-		mic_tcp_pdu pdu = {
-			.header = {
-				.source_port = sockets[socket].addr.port,
-				.dest_port = addr.port,
-				.seq_num = seq[socket],
-				.ack_num = UINT_MAX,
-				.syn = 1,
-				.ack = 0,
-				.fin = 0
-			},
-			.payload.size = 0
-		}, pdu_ack = {0};
-		// Proposition du pourcentage de fiabilité partielle.
-		export_reliability(&pdu, MICTCP_RELIABILITY);
-		#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
-			printf("Setting reliability proposal to %u%c...\n", MICTCP_RELIABILITY, '%');
-		#endif
-		prepare_for_reliability(&pdu_ack);
-		// Mise à jour du numéro de séquence.
-		seq[socket] = (seq[socket] + 1) % 2;
-		// Envoi du SYN.
-		sockets[socket].state = SYN_SENT;
-		int tries = 0, result = -1;
-		do
+		loan->packet = NULL;
+		loan->data = NULL;
+		loan->size = 0;
+		if (eof[socket])
+			return 0;
+		mic_tcp_payload payload;
+		unsigned long received_at;
+		const int result = app_buffer_get_loan(socket, &payload, &received_at, &loan->stream, &loan->packet);
+		if (result == 0)
 		{
-			result = IP_send(pdu, addr);
-			// Attente du SYN ACK.
-			if (result >= 0)
-			{
-				result = IP_recv(&pdu_ack, &addr, MICTCP_TIMEOUT_CONNECT);
-				if (result >= 0)
-				{
-					if (pdu_ack.header.syn == 1 && pdu_ack.header.ack == 1 && pdu_ack.header.ack_num == seq[socket])
-					{
-						const char reliability = import_reliability(&pdu_ack);
-						if (reliability == MICTCP_RELIABILITY)
-						{
-							// Application de la valeur finale de fiabilité partielle.
-							loss_distance_max[socket] = loss_distance_max_from_reliability(reliability);
-							#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
-								printf("Confirmed reliability to %u%c (loss distance : %u).\n", reliability, '%', loss_distance_max[socket]);
-							#endif
-							// Envoi du ACK.
-							pdu.header.seq_num = seq[socket];
-							pdu.header.ack_num = seq[socket];
-							pdu.header.syn = 0;
-							pdu.header.ack = 1;
-							do result = IP_send(pdu, addr);
-							while (result < 0);
-							// Connexion établie.
-							connections[socket] = addr;
-							sockets[socket].state = ESTABLISHED;
-							#ifdef MICTCP_DEBUG_CONNECTION
-								printf("Connection established.\n");
-							#endif
-							result = 0;
-						}
-					}
-					else printf("Connection refused.\n");
-				}
-			}
+			eof[socket] = 1;
+			app_buffer_release(loan->packet);
+			loan->packet = NULL;
+			return 0;
 		}
-		while (result < 0 && ++tries < MICTCP_RETRIES);
-		free(pdu.payload.data);
-		free(pdu_ack.payload.data);
-		return result < 0 ? -1 : 0;
+		loan->data = payload.data;
+		loan->size = payload.size;
+		mictcp_hist_record(&latencies[socket][LATENCY_DELIVERY], get_now_time_usec() - received_at);
+		return result;
 	}
 	return -1;
 }
 
 /*
- * Permet de réclamer l’envoi d’une donnée applicative
- * Retourne la taille des données envoyées, et -1 en cas d'erreur
+ * Rend le tampon d'une donnée prêtée par mic_tcp_recv_zc (y compris après la
+ * fermeture du socket).
+ * Retourne 0 si succès, -1 en cas d'erreur
  */
-int mic_tcp_send (int socket, char* mesg, int mesg_size)
+int mic_tcp_release(int socket, mic_tcp_loan* loan)
 {
 	MICTCP_DEBUG_FUNCTION;
-	if (socket >= 0 && socket < socketd && sockets[socket].state == ESTABLISHED)
+	if (socket < 0 || socket >= socketd || loan == NULL || loan->packet == NULL)
+		return -1;
+	app_buffer_release(loan->packet);
+	loan->packet = NULL;
+	loan->data = NULL;
+	return 0;
+}
+
+// Envoie les petits messages en attente de tous les flux d'un socket.
+// Retourne 0 si succès, -1 si les messages d'un flux n'ont pu être remis.
+static int flush_corks(int socket)
+{
+	int k, result = 0;
+	for (k = 0; k < MICTCP_STREAMS; k++)
 	{
-		mic_tcp_pdu pdu = {
-			.header = {
-				.source_port = sockets[socket].addr.port,
-				.dest_port = connections[socket].port,
-				.seq_num = seq[socket],
-				.ack_num = UINT_MAX,
-				.syn = 0,
-				.ack = 0,
-				.fin = 0
-			},
-			.payload = {
-				.data = mesg,
-				.size = mesg_size
-			}
-		}, pdu_ack = {0};
-		// Mise à jour du numéro de séquence.
-		seq[socket] = (seq[socket] + 1) % 2;
-		// Mise à jour des pertes.
-		loss_distance[socket]++;
-		#ifdef MICTCP_DEBUG_RELIABILITY
-			sent++;
-		#endif
-		int result = -1, resend = 1, perte = 0;
-		do
-		{
-			pdu_ack.header.ack = 0;
-			pdu_ack.header.ack_num = UINT_MAX;
-			// Envoi du PDU.
-			result = IP_send(pdu, connections[socket]);
-			if (result == mesg_size)
-			{
-				// Attente du ACK.
-				result = IP_recv(&pdu_ack, &connections[socket], MICTCP_TIMEOUT_ACK);
-				// Si ACK reçu et que la séquence correspond, arrêt.
-				if (result == 0)
-				{
-					if (pdu_ack.header.ack == 1 && pdu_ack.header.ack_num == seq[socket])
-						resend = 0;
-					#ifdef MICTCP_DEBUG_REJECTED
-						else printf("ACK#%d packet rejected.\n", pdu_ack.header.ack_num);
-					#endif
-				}
-				// Sinon, on enregistre une perte.
-				else
-				{
-					// Si c'est la première perte pour ce paquet, on défini si on doit le renvoyer.
-					if (perte == 0)
-					{
-						perte = 1;
-						// Si la perte n'est pas admissible, on réinitialise la distance de perte.
-						if (loss_distance[socket] > loss_distance_max[socket])
-							loss_distance[socket] = 0;
-						// Sinon, on l'ignore.
-						else resend = 0;
-					}
-					#ifdef MICTCP_DEBUG_LOSS
-						printf("Lost packet #%d ", pdu.header.seq_num);
-						printf(resend == 0 ? "ignored" : "resent");
-						printf(".\n");
-					#endif
-					#ifdef MICTCP_DEBUG_RELIABILITY
-						lost++;
-						if (resend) resent++;
-					#endif
-				}
-			}
-		}
-		while (resend == 1);
-		return mesg_size;
+		pthread_mutex_lock(&cork_locks[socket][k]);
+		if (cork_flush(socket, k) == -1)
+			result = -1;
+		pthread_mutex_unlock(&cork_locks[socket][k]);
 	}
-	return -1;
+	return result;
 }
 
 /*
- * Permet à l’application réceptrice de réclamer la récupération d’une donnée
- * stockée dans les buffers de réception du socket
- * Retourne le nombre d’octets lu ou bien -1 en cas d’erreur
- * NB : cette fonction fait appel à la fonction app_buffer_get()
+ * Envoie sans attendre les petits messages regroupés de tous les flux (OPT_CORK).
+ * Retourne 0 si succès, -1 en cas d'erreur
  */
-int mic_tcp_recv (int socket, char* mesg, int max_mesg_size)
+int mic_tcp_flush(int socket)
 {
 	MICTCP_DEBUG_FUNCTION;
 	if (socket >= 0 && socket < socketd && sockets[socket].state == ESTABLISHED)
+		return flush_corks(socket);
+	return -1;
+}
+
+// Envoie le FIN d'un socket client (sur le flux 0, dont il consomme un numéro de séquence)
+// et attend son acquittement, en OPT_RETRIES tentatives au plus.
+// Retourne 0 si le serveur l'a acquitté, -1 sinon.
+static int send_fin(int socket)
+{
+	mic_tcp_pdu pdu = {
+		.header = {
+			.source_port = sockets[socket].addr.port,
+			.dest_port = connections[socket].port,
+			.seq_num = seq[socket][0],
+			.ack_num = UINT_MAX,
+			.syn = 0,
+			.ack = 0,
+			.fin = 1,
+			.stream = 0
+		}
+	};
+	seq[socket][0] = (seq[socket][0] + 1) % 2;
+	int tries = 0;
+	do
 	{
-		mic_tcp_payload payload = {
-			.data = mesg,
-			.size = max_mesg_size
-		};
-		// Définition du descripteur du socket de réception.
-		current_socket = socket;
-		return app_buffer_get(payload);
+		IP_send(pdu, connections[socket]);
+		STAT_ADD(socket, pdus_sent, 1);
+		if (wait_ack(socket, 0, seq[socket][0], ack_timeout(socket, tries + 1)) == 0)
+			return 0;
 	}
+	while (++tries < options[socket][OPT_RETRIES] && sockets[socket].state == CLOSING);
 	return -1;
 }
 
+// Envoie un FIN au client d'un socket serveur, sans attendre d'acquittement : le client
+// le lit avec le ACK de son prochain envoi, qui échoue alors.
+static void send_fin_to_client(int socket)
+{
+	mic_tcp_pdu pdu = {
+		.header = {
+			.source_port = sockets[socket].addr.port,
+			.dest_port = connections[socket].port,
+			.seq_num = UINT_MAX,
+			.ack_num = UINT_MAX,
+			.syn = 0,
+			.ack = 0,
+			.fin = 1,
+			.stream = 0
+		}
+	};
+	IP_send(pdu, connections[socket]);
+	STAT_ADD(socket, pdus_sent, 1);
+}
+
+// Fait passer un socket serveur fermé en TIME_WAIT ; les données jamais lues sont libérées.
+static void enter_time_wait(int socket)
+{
+	time_wait_deadline[socket] = get_now_time_usec() + (unsigned long)options[socket][OPT_TIME_WAIT] * 1000;
+	set_state(socket, TIME_WAIT);
+	app_buffer_clear(socket);
+}
+
+// Ferme un socket d'écoute : les connexions établies jamais remises par mic_tcp_accept sont
+// fermées (FIN au client), celles en cours d'établissement abandonnées.
+static void close_listener(int socket)
+{
+	int s;
+	pthread_mutex_lock(&accept_lock);
+	set_state(socket, CLOSED);
+	for (s = 0; s < socketd; s++)
+	{
+		if (parents[s] != socket)
+			continue;
+		parents[s] = -1;
+		if (sockets[s].state == IDLE || sockets[s].state == SYN_RECEIVED)
+			set_state(s, CLOSED);
+		else
+		{
+			send_fin_to_client(s);
+			enter_time_wait(s);
+		}
+	}
+	accept_count[socket] = 0;
+	half_open[socket] = 0;
+	pthread_mutex_unlock(&accept_lock);
+	// Réveil de mic_tcp_accept.
+	signal_event();
+}
+
 /*
  * Permet de réclamer la destruction d’un socket.
- * Engendre la fermeture de la connexion suivant le modèle de TCP.
+ * Engendre la fermeture de la connexion suivant le modèle de TCP : côté client, les
+ * messages en attente et les envois en cours sont menés à leur terme, puis un FIN
+ * signale la fin du flux au serveur, dont mic_tcp_recv retourne alors 0. Côté serveur,
+ * le socket reste OPT_TIME_WAIT ms en TIME_WAIT pour acquitter les renvois de son
+ * client, avant que son descripteur ne soit réutilisé. Un socket d'écoute ferme les
+ * connexions qui n'ont pas encore été remises par mic_tcp_accept.
  * Retourne 0 si tout se passe bien et -1 en cas d'erreur
  */
 int mic_tcp_close (int socket)
 {
 	MICTCP_DEBUG_FUNCTION;
-	if (socket >= 0 && socket < socketd && sockets[socket].state == ESTABLISHED)
+	if (socket >= 0 && socket < socketd && sockets[socket].state == LISTEN)
+	{
+		close_listener(socket);
+		return 0;
+	}
+	if (socket < 0 || socket >= socketd || (sockets[socket].state != ESTABLISHED && sockets[socket].state != CLOSE_WAIT))
+		return -1;
+	if (sockets[socket].state == ESTABLISHED)
+	{
+		set_state(socket, CLOSING);
+		if (modes[socket] == CLIENT)
+		{
+			// Envoi des messages en attente, puis attente des envois en cours.
+			if (flush_corks(socket) == -1)
+				MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] Messages regroupés perdus, connexion fermée.");
+			pthread_mutex_lock(&ack_lock);
+			while (__atomic_load_n(&sending[socket], __ATOMIC_SEQ_CST) > 0)
+				pthread_cond_wait(&ack_cond, &ack_lock);
+			pthread_mutex_unlock(&ack_lock);
+			// Une connexion reprise sans aucun envoi est inconnue du serveur.
+			if (resuming[socket] != RESUME_PENDING && sockets[socket].state == CLOSING && send_fin(socket) == -1)
+				MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] FIN non acquitté, connexion fermée.");
+		}
+		else
+			send_fin_to_client(socket);
+	}
+	#ifdef MICTCP_DEBUG_RELIABILITY
+		mic_tcp_stats st;
+		mic_tcp_getstats(socket, &st);
+		const unsigned long sent = st.pdus_sent > st.retransmits ? st.pdus_sent - st.retransmits : 0;
+		if (st.bytes_sent > 0)
+			MICTCP_LOG(MICTCP_LOG_DEBUG, "%lu sent, %lu lost (lost / send = %f%c), %lu resent (resent / lost = %f%c) -> 1 - ignored / sent = %f%c",
+					sent, st.losses, ((double)st.losses / (double)sent) * 100.0, '%',
+					st.retransmits, ((double)st.retransmits / (double)st.losses) * 100.0, '%',
+					(1.0 - ((double)st.losses_ignored / (double)sent)) * 100.0, '%'
+				);
+	#endif
+	if (modes[socket] == SERVER)
+		enter_time_wait(socket);
+	else
+		set_state(socket, CLOSED);
+	#ifdef MICTCP_DEBUG_CONNECTION
+		MICTCP_LOG(MICTCP_LOG_DEBUG, "Connection closed.");
+	#endif
+	return 0;
+}
+
+// Envoie le SYN ACK d'un SYN : paramètres retenus (fiabilités partielles, MSS et compression),
+// suivis d'un jeton de reprise ou d'un SYN cookie (token, s'il n'est pas NULL).
+static void send_syn_ack(int socket, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr, const char* values, int size, int compress,
+	const unsigned char* token)
+{
+	mic_tcp_pdu pdu_syn_ack = {
+		.header = {
+			.source_port = pdu->header.dest_port,
+			.dest_port = pdu->header.source_port,
+			.seq_num = pdu->header.seq_num,
+			.ack_num = (pdu->header.seq_num + 1) % 2,
+			.syn = 1,
+			.ack = 1,
+			.fin = 0
+		}
+	};
+	export_reliability(&pdu_syn_ack, values);
+	export_mss(&pdu_syn_ack, size);
+	export_compression(&pdu_syn_ack, compress);
+	if (token != NULL)
+	{
+		pdu_syn_ack.payload.data = realloc(pdu_syn_ack.payload.data, HANDSHAKE_SIZE + TOKEN_SIZE);
+		memcpy(pdu_syn_ack.payload.data + HANDSHAKE_SIZE, token, TOKEN_SIZE);
+		pdu_syn_ack.payload.size = HANDSHAKE_SIZE + TOKEN_SIZE;
+	}
+	IP_send(pdu_syn_ack, addr);
+	STAT_ADD(socket, pdus_sent, 1);
+	free(pdu_syn_ack.payload.data);
+}
+
+// Répond à un SYN reçu par une nouvelle connexion d'un socket d'écoute (SYN ACK).
+static void accept_syn(int socket, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr)
+{
+	if (sockets[socket].state == IDLE)
+	{
+		pthread_mutex_lock(&accept_lock);
+		half_open[parents[socket]]++;
+		set_state(socket, SYN_RECEIVED);
+		pthread_mutex_unlock(&accept_lock);
+		connections[socket] = addr;
+		// Le client abandonne après OPT_RETRIES SYN sans réponse.
+		half_open_deadline[socket] = get_coarse_time_usec()
+			+ (unsigned long)options[socket][OPT_TIMEOUT_CONNECT] * options[socket][OPT_RETRIES] * 1000;
+		// Récupération des pourcentages de fiabilité partielle des flux.
+		int k;
+		for (k = 0; k < MICTCP_STREAMS; k++)
+		{
+			const char reliability = import_reliability(pdu, k);
+			loss_distance_max[socket][k] = loss_distance_max_from_reliability(socket, reliability);
+			reliabilities[socket][k] = reliability;
+			#ifdef MICTCP_DEBUG_RELIABILITY_DEFINITION
+				MICTCP_LOG(MICTCP_LOG_DEBUG, "Reliability of stream %d set to %d%c (loss distance : %u).", k, reliability, '%', loss_distance_max[socket][k]);
+			#endif
+			// Définition des numéros de séquence (la poignée de main utilise le flux 0).
+			seq[socket][k] = k == 0 ? (pdu->header.seq_num + 1) % 2 : MICTCP_INITIAL_SEQ;
+		}
+		// La plus petite des deux MSS est retenue.
+		mss[socket] = import_mss(pdu, options[socket][OPT_MSS]);
+		// La compression n'est retenue que si les deux extrémités l'acceptent.
+		compression[socket] = import_compression(pdu, options[socket][OPT_COMPRESS]);
+		if (options[socket][OPT_RESUME])
+			issue_token(socket);
+	}
+	// Envoi (ou renvoi si le précédent a été perdu) du SYN ACK, suivi d'un jeton de reprise.
+	send_syn_ack(socket, pdu, addr, reliabilities[socket], mss[socket], compression[socket],
+		options[socket][OPT_RESUME] ? tokens[socket] : NULL);
+}
+
+// Répond au SYN reçu par un socket d'écoute dont la file est pleine par un SYN ACK portant un
+// SYN cookie, sans rien garder : les paramètres de la connexion reviendront avec le cookie.
+static void send_cookie(int listener, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr)
+{
+	char values[MICTCP_STREAMS];
+	unsigned char cookie[TOKEN_SIZE];
+	const int size = import_mss(pdu, options[listener][OPT_MSS]);
+	const int compress = import_compression(pdu, options[listener][OPT_COMPRESS]);
+	int k;
+	for (k = 0; k < MICTCP_STREAMS; k++)
+		values[k] = import_reliability(pdu, k);
+	make_token(cookie, COOKIE_MAGIC, values, size, compress, pdu->header.source_port);
+	send_syn_ack(listener, pdu, addr, values, size, compress, cookie);
+	#ifdef MICTCP_DEBUG_CONNECTION
+		MICTCP_LOG(MICTCP_LOG_DEBUG, "Backlog full, SYN cookie sent.");
+	#endif
+}
+
+// Remet une connexion établie d'un socket d'écoute à mic_tcp_accept (file FIFO).
+static void connection_established(int socket)
+{
+	const int listener = parents[socket];
+	pthread_mutex_lock(&accept_lock);
+	if (sockets[socket].state == SYN_RECEIVED)
+		half_open[listener]--;
+	set_state(socket, ESTABLISHED);
+	accept_queue[listener][(accept_head[listener] + accept_count[listener]) % MICTCP_SOCKETS] = socket;
+	__atomic_store_n(&accept_count[listener], accept_count[listener] + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&accept_lock);
+	signal_event();
+}
+
+// Crée le socket d'une nouvelle connexion d'un socket d'écoute, qui en hérite l'adresse et les
+// options. Une connexion ouverte par un SYN compte les connexions en cours d'établissement,
+// dont celles où le client ne répond plus sont d'abord abandonnées ; une connexion établie
+// d'emblée (jeton ou SYN cookie) ne compte que celles qui attendent mic_tcp_accept : une
+// inondation de SYN ne bloque pas les clients au SYN cookie valide.
+// Retourne le descripteur, ou -1 si la file est pleine ou aucun n'est libre.
+static int open_connection(int listener, int established)
+{
+	const unsigned long now = get_coarse_time_usec();
+	int s, d = -1;
+	pthread_mutex_lock(&accept_lock);
+	if (!established && half_open[listener] + accept_count[listener] >= options[listener][OPT_BACKLOG])
+		for (s = 0; s < socketd; s++)
+			if (parents[s] == listener && sockets[s].state == SYN_RECEIVED && now >= half_open_deadline[s])
+			{
+				parents[s] = -1;
+				half_open[listener]--;
+				set_state(s, CLOSED);
+			}
+	const int queued = accept_count[listener] + (established ? 0 : half_open[listener]);
+	if (sockets[listener].state == LISTEN && queued < options[listener][OPT_BACKLOG] && (d = claim_socket(SERVER)) >= 0)
+	{
+		sockets[d].addr = sockets[listener].addr;
+		memcpy(options[d], options[listener], sizeof(options[d]));
+		STAT_SET(d, window, options[d][OPT_WINDOW]);
+		mss[d] = options[d][OPT_MSS];
+		parents[d] = listener;
+	}
+	pthread_mutex_unlock(&accept_lock);
+	return d;
+}
+
+// Libère le socket d'une connexion refusée avant son établissement.
+static void drop_connection(int socket)
+{
+	pthread_mutex_lock(&accept_lock);
+	if (sockets[socket].state == SYN_RECEIVED)
+		half_open[parents[socket]]--;
+	parents[socket] = -1;
+	set_state(socket, CLOSED);
+	pthread_mutex_unlock(&accept_lock);
+}
+
+// Admet un jeton de reprise (ou un SYN cookie) valide sur un socket serveur : ses paramètres doivent rester
+// compatibles avec les options du socket, et il ne doit pas avoir déjà servi. Un jeton dont
+// la case est encore occupée par un autre est aussi refusé : le client refera une poignée de
+// main complète. Retourne 1 si la connexion est reprise, 0 sinon.
+static int resume_admit(int socket, const unsigned char* token)
+{
+	mic_tcp_pdu view = token_parameters(token);
+	const int size = import_mss(&view, INT_MAX), compress = import_compression(&view, 1);
+	const unsigned int nonce = get_u32(token + TOKEN_NONCE), issued = get_u32(token + TOKEN_ISSUED);
+	char values[MICTCP_STREAMS];
+	int k;
+	for (k = 0; k < MICTCP_STREAMS; k++)
+		if ((values[k] = view.payload.data[k]) < 0 || values[k] > 100)
+			return 0;
+	if (size > options[socket][OPT_MSS] || (compress && !options[socket][OPT_COMPRESS]))
+		return 0;
+	if (resume_replay[nonce % RESUME_REPLAY].expiry > token_now())
 	{
-		sockets[socket].state = CLOSING;
-		#ifdef MICTCP_DEBUG_RELIABILITY
-			if (sent > 0)
-				printf(	"%d sent, %d lost (lost / send = %f%c), %d resent (resent / lost = %f%c) -> 1 - (lost - resent) / sent = %f%c\n",
-						sent, lost, ((double)lost / (double)sent) * 100.0, '%',
-						resent, ((double)resent / (double)lost) * 100.0, '%',
-						(1.0 - ((double)(lost - resent) / (double)sent)) * 100.0, '%'
-					);
+		#ifdef MICTCP_DEBUG_REJECTED
+			if (resume_replay[nonce % RESUME_REPLAY].nonce == nonce)
+				MICTCP_LOG(MICTCP_LOG_DEBUG, "Resumption token #%u replayed.", nonce);
 		#endif
-		sockets[socket].state = CLOSED;
+		return 0;
+	}
+	resume_replay[nonce % RESUME_REPLAY].nonce = nonce;
+	resume_replay[nonce % RESUME_REPLAY].expiry = (unsigned long)issued
+		+ (token[0] == COOKIE_MAGIC ? COOKIE_LIFETIME : MICTCP_RESUME_LIFETIME);
+	apply_parameters(socket, values, size, compress);
+	return 1;
+}
+
+// Traite le jeton de reprise, ou le SYN cookie, en tête d'un SYN de données reçu par une
+// nouvelle connexion d'un socket d'écoute. S'il est admis, la connexion est établie avec ses
+// paramètres et, avec OPT_RESUME, un nouveau jeton est délivré (renvoyé avec le ACK) ; le renvoi
+// d'un PDU déjà admis, dont le ACK a été perdu, est traité comme un doublon. Le jeton est alors
+// retiré du PDU. Sinon, un SYN ACK vide refuse la reprise.
+// Retourne 0 si les données du PDU doivent être traitées, -1 sinon.
+static int resume_syn(int socket, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr)
+{
+	const unsigned char* token = (const unsigned char*)pdu->payload.data;
+	const unsigned int nonce = get_u32(token + TOKEN_NONCE);
+	const unsigned short port = pdu->header.source_port;
+	if (sockets[socket].state == ESTABLISHED && resumed_nonce[socket] == nonce && token_valid(token, port))
+		;
+	else if (sockets[socket].state == IDLE && (token[0] == COOKIE_MAGIC || options[socket][OPT_RESUME])
+		&& token_valid(token, port) && resume_admit(socket, token))
+	{
+		int k;
+		connections[socket] = addr;
+		for (k = 0; k < MICTCP_STREAMS; k++)
+			seq[socket][k] = MICTCP_INITIAL_SEQ;
+		resumed_nonce[socket] = nonce;
+		if (options[socket][OPT_RESUME])
+			issue_token(socket);
 		#ifdef MICTCP_DEBUG_CONNECTION
-			printf("Connection closed.\n");
+			MICTCP_LOG(MICTCP_LOG_DEBUG, token[0] == COOKIE_MAGIC ? "Connection established by SYN cookie." : "Connection resumed.");
 		#endif
-		return 0;
+		connection_established(socket);
+	}
+	else
+	{
+		mic_tcp_pdu pdu_refusal = {
+			.header = {
+				.source_port = pdu->header.dest_port,
+				.dest_port = pdu->header.source_port,
+				.seq_num = UINT_MAX,
+				.ack_num = UINT_MAX,
+				.syn = 1,
+				.ack = 1,
+				.fin = 0,
+				.stream = pdu->header.stream
+			}
+		};
+		IP_send(pdu_refusal, addr);
+		STAT_ADD(socket, pdus_sent, 1);
+		return -1;
+	}
+	pdu->payload.data += TOKEN_SIZE;
+	pdu->payload.size -= TOKEN_SIZE;
+	pdu->header.syn = 0;
+	return 0;
+}
+
+// Remet un segment reçu dans l'ordre : seul, il est remis directement ; sinon il est
+// ajouté au message en cours du flux, remis avec son dernier segment.
+static void reassemble(int socket, int stream, mic_tcp_pdu* pdu)
+{
+	mic_tcp_payload* message = &segments[socket][stream];
+	if (message->size == 0 && !segments_discarded[socket][stream] && !pdu->header.more)
+	{
+		app_buffer_put_stream(socket, pdu->payload, stream);
+		return;
+	}
+	if (!segments_discarded[socket][stream])
+	{
+		const int size = message->size + pdu->payload.size;
+		if (size > MICTCP_MESSAGE_MAX)
+		{
+			MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] Message du flux %d trop grand (> %d octets), ignoré.", stream, MICTCP_MESSAGE_MAX);
+			segments_discarded[socket][stream] = 1;
+			message->size = 0;
+		}
+		else
+		{
+			if (size > segments_capacity[socket][stream])
+			{
+				segments_capacity[socket][stream] = size > 2 * segments_capacity[socket][stream] ? size : 2 * segments_capacity[socket][stream];
+				message->data = realloc(message->data, segments_capacity[socket][stream]);
+			}
+			memcpy(message->data + message->size, pdu->payload.data, pdu->payload.size);
+			message->size = size;
+		}
+	}
+	if (!pdu->header.more)
+	{
+		if (!segments_discarded[socket][stream])
+			app_buffer_put_stream(socket, *message, stream);
+		message->size = 0;
+		segments_discarded[socket][stream] = 0;
+	}
+}
+
+// Remplace la charge utile compressée d'un PDU par sa version décompressée dans buffer.
+// Retourne -1 si elle est invalide.
+static int inflate_payload(mic_tcp_pdu* pdu, char* buffer, int capacity)
+{
+	const int size = mictcp_lz4_decompress(pdu->payload.data, pdu->payload.size, buffer, capacity);
+	if (size < 0)
+		return -1;
+	pdu->payload.data = buffer;
+	pdu->payload.size = size;
+	return 0;
+}
+
+// Remet un à un les messages regroupés dans un PDU (taille sur 2 octets, puis données).
+static void unbatch(int socket, int stream, mic_tcp_pdu* pdu)
+{
+	const unsigned char* data = (const unsigned char*)pdu->payload.data;
+	int offset = 0;
+	while (offset + 2 <= pdu->payload.size)
+	{
+		const int size = data[offset] << 8 | data[offset + 1];
+		if (offset + 2 + size > pdu->payload.size)
+			break;
+		mic_tcp_payload message = {
+			.data = pdu->payload.data + offset + 2,
+			.size = size
+		};
+		app_buffer_put_stream(socket, message, stream);
+		offset += 2 + size;
+	}
+	if (offset != pdu->payload.size)
+		MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] Regroupement du flux %d mal formé, %d octets ignorés.", stream, pdu->payload.size - offset);
+}
+
+// Socket serveur de la connexion d'un PDU reçu (ports de l'en-tête), -1 si aucun.
+static int connection_socket(mic_tcp_pdu* pdu)
+{
+	int s;
+	for (s = 0; s < socketd; s++)
+		if (modes[s] == SERVER && connections[s].port == pdu->header.source_port && sockets[s].addr.port == pdu->header.dest_port
+			&& (sockets[s].state == SYN_RECEIVED || sockets[s].state == ESTABLISHED || sockets[s].state == CLOSE_WAIT))
+			return s;
+	return -1;
+}
+
+// Socket d'écoute du port destinataire d'un PDU, -1 si aucun.
+static int listening_socket(mic_tcp_pdu* pdu)
+{
+	int s;
+	for (s = 0; s < socketd; s++)
+		if (modes[s] == SERVER && sockets[s].state == LISTEN && sockets[s].addr.port == pdu->header.dest_port)
+			return s;
+	return -1;
+}
+
+// Socket serveur en TIME_WAIT auquel revient un PDU de son ancien client, -1 si aucun.
+// Un SYN de ce client ouvre une nouvelle connexion et met fin à l'état TIME_WAIT.
+static int lingering_socket(mic_tcp_pdu* pdu)
+{
+	int s;
+	for (s = 0; s < socketd; s++)
+	{
+		if (modes[s] != SERVER || sockets[s].state != TIME_WAIT || is_free(s)
+			|| connections[s].port != pdu->header.source_port || sockets[s].addr.port != pdu->header.dest_port)
+			continue;
+		if (pdu->header.syn == 1 && pdu->header.ack == 0)
+			set_state(s, CLOSED);
+		else
+			return s;
 	}
 	return -1;
 }
 
+// Répond à un PDU reçu par un socket en TIME_WAIT : le renvoi d'un PDU dont le ACK a été
+// perdu (données ou FIN) est acquitté de nouveau, une donnée nouvelle reçoit un FIN.
+static void linger(int socket, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr)
+{
+	const int stream = pdu->header.stream;
+	STAT_ADD(socket, pdus_received, 1);
+	if (pdu->header.ack == 1 || !stream_valid(stream))
+		return;
+	mic_tcp_pdu reply = {
+		.header = {
+			.source_port = pdu->header.dest_port,
+			.dest_port = pdu->header.source_port,
+			.seq_num = UINT_MAX,
+			.ack_num = seq[socket][stream],
+			.syn = 0,
+			.ack = 1,
+			.fin = 0,
+			.stream = stream
+		}
+	};
+	if (pdu->header.seq_num == seq[socket][stream])
+	{
+		reply.header.ack_num = UINT_MAX;
+		reply.header.ack = 0;
+		reply.header.fin = 1;
+	}
+	else
+		STAT_ADD(socket, duplicates, 1);
+	IP_send(reply, addr);
+	STAT_ADD(socket, pdus_sent, 1);
+}
+
+// Répond par un FIN aux données adressées à un socket d'écoute par une connexion qu'il ne
+// connaît pas (abandonnée, ou antérieure au démarrage du serveur) : le client cesse ses renvois.
+static void refuse_data(int listener, mic_tcp_pdu* pdu, mic_tcp_sock_addr addr)
+{
+	mic_tcp_pdu pdu_fin = {
+		.header = {
+			.source_port = pdu->header.dest_port,
+			.dest_port = pdu->header.source_port,
+			.seq_num = UINT_MAX,
+			.ack_num = UINT_MAX,
+			.syn = 0,
+			.ack = 0,
+			.fin = 1,
+			.stream = pdu->header.stream
+		}
+	};
+	IP_send(pdu_fin, addr);
+	STAT_ADD(listener, pdus_sent, 1);
+}
+
 /*
  * Traitement d’un PDU MIC-TCP reçu (mise à jour des numéros de séquence
  * et d'acquittement, etc.) puis insère les données utiles du PDU dans
@@ -399,34 +2089,237 @@ int mic_tcp_close (int socket)
 void process_received_PDU(mic_tcp_pdu pdu, mic_tcp_sock_addr addr)
 {
 	MICTCP_DEBUG_FUNCTION;
-	if (current_socket < MICTCP_SOCKETS && sockets[current_socket].state == ESTABLISHED)
+	// PDU d'une connexion fermée récemment : il ne doit pas atteindre la suivante.
+	const int lingering = lingering_socket(&pdu);
+	if (lingering >= 0)
+	{
+		linger(lingering, &pdu, addr);
+		return;
+	}
+	// PDU de données porteur d'un jeton de reprise ou d'un SYN cookie.
+	const int carrier = pdu.header.syn == 1 && pdu.header.ack == 0 && pdu.payload.size >= TOKEN_SIZE
+		&& ((unsigned char)pdu.payload.data[0] == TOKEN_MAGIC || (unsigned char)pdu.payload.data[0] == COOKIE_MAGIC);
+	// Socket de la connexion ; à défaut, le socket d'écoute du port en ouvre une pour un SYN
+	// ou un PDU porteur.
+	int socket = connection_socket(&pdu);
+	if (socket < 0)
+	{
+		const int listener = listening_socket(&pdu);
+		if (listener >= 0 && pdu.header.syn == 1 && pdu.header.ack == 0)
+		{
+			socket = open_connection(listener, carrier);
+			// File pleine : SYN cookie, sans rien garder ; un PDU porteur est ignoré, le
+			// client le renverra.
+			if (socket < 0 && !carrier)
+				send_cookie(listener, &pdu, addr);
+		}
+		else if (listener >= 0 && pdu.header.ack == 0 && stream_valid(pdu.header.stream))
+			refuse_data(listener, &pdu, addr);
+		if (socket < 0)
+		{
+			#ifdef MICTCP_DEBUG_REJECTED
+				MICTCP_LOG(MICTCP_LOG_DEBUG, "Packet #%d ignored.", pdu.header.seq_num);
+			#endif
+			return;
+		}
+	}
+	STAT_ADD(socket, pdus_received, 1);
+	// Reprise, ou SYN cookie : le jeton établit la connexion.
+	if (carrier && resume_syn(socket, &pdu, addr) == -1)
+	{
+		if (sockets[socket].state == IDLE)
+			drop_connection(socket);
+		return;
+	}
+	// Poignée de main : SYN (éventuellement répété).
+	if (pdu.header.syn == 1 && pdu.header.ack == 0
+		&& (sockets[socket].state == IDLE || sockets[socket].state == SYN_RECEIVED))
 	{
+		accept_syn(socket, &pdu, addr);
+		return;
+	}
+	// Poignée de main : ACK final, ou premier PDU de données si celui-ci a été perdu.
+	if (sockets[socket].state == SYN_RECEIVED && pdu.header.syn == 0)
+	{
+		connection_established(socket);
+		#ifdef MICTCP_DEBUG_CONNECTION
+			MICTCP_LOG(MICTCP_LOG_DEBUG, "Connection established.");
+		#endif
+		if (pdu.header.ack == 1)
+			return;
+	}
+	// Données, ou FIN ; après le FIN (CLOSE_WAIT), seuls ses renvois sont acquittés.
+	if ((sockets[socket].state == ESTABLISHED || sockets[socket].state == CLOSE_WAIT)
+		&& pdu.header.syn == 0 && pdu.header.ack == 0 && stream_valid(pdu.header.stream))
+	{
+		const int stream = pdu.header.stream;
 		mic_tcp_pdu pdu_ack = {
 			.header = {
 				.source_port = pdu.header.dest_port,
 				.dest_port = pdu.header.source_port,
 				.seq_num = UINT_MAX,
-				.ack_num = seq[current_socket],
-				.syn = 0,
+				.ack_num = seq[socket][stream],
+				.syn = carrier && options[socket][OPT_RESUME],
 				.ack = 1,
-				.fin = 0
+				.fin = 0,
+				.stream = stream
 			}
 		};
-		// Si la séquence est celle attendue, traitement de la trame.
-		if (pdu.header.seq_num == seq[current_socket])
+		// Le ACK d'un PDU porteur apporte le jeton de reprise suivant.
+		if (carrier && options[socket][OPT_RESUME])
 		{
-			app_buffer_put(pdu.payload);
-			// Passage à la séquence suivante.
-			seq[current_socket] = (seq[current_socket] + 1) % 2;
-			pdu_ack.header.ack_num = seq[current_socket];
+			pdu_ack.payload.data = (char*)tokens[socket];
+			pdu_ack.payload.size = TOKEN_SIZE;
+		}
+		// Si la séquence du flux est celle attendue, traitement de la trame.
+		if (pdu.header.seq_num == seq[socket][stream] && sockets[socket].state == ESTABLISHED)
+		{
+			// Passage à la séquence suivante, avant la remise : l'application peut fermer
+			// le socket (et un nouveau le remplacer) dès qu'elle a reçu la donnée.
+			seq[socket][stream] = (seq[socket][stream] + 1) % 2;
+			pdu_ack.header.ack_num = seq[socket][stream];
+			// Décompression de la charge utile (au plus une MSS).
+			char inflated[pdu.header.compressed ? mss[socket] : 1];
+			// Fin du flux : une donnée vide, remise après toutes les autres.
+			if (pdu.header.fin)
+			{
+				mic_tcp_payload end = {
+					.data = pdu.payload.data,
+					.size = 0
+				};
+				set_state(socket, CLOSE_WAIT);
+				app_buffer_put_stream(socket, end, stream);
+				#ifdef MICTCP_DEBUG_CONNECTION
+					MICTCP_LOG(MICTCP_LOG_DEBUG, "Connection closed by peer.");
+				#endif
+			}
+			else if (pdu.header.compressed && inflate_payload(&pdu, inflated, sizeof(inflated)) == -1)
+				MICTCP_LOG(MICTCP_LOG_WARN, "[MIC-TCP] Charge utile compressée du flux %d invalide, ignorée.", stream);
+			else if (pdu.header.batch)
+				unbatch(socket, stream, &pdu);
+			else
+				reassemble(socket, stream, &pdu);
+			STAT_ADD(socket, bytes_received, pdu.payload.size);
+		}
+		// Sinon, c'est un renvoi d'un PDU dont le ACK a été perdu.
+		else
+		{
+			STAT_ADD(socket, duplicates, 1);
+			#ifdef MICTCP_DEBUG_REJECTED
+				MICTCP_LOG(MICTCP_LOG_DEBUG, "Packet #%d (stream %d) rejected.", pdu.header.seq_num, stream);
+			#endif
 		}
-		#ifdef MICTCP_DEBUG_REJECTED
-			else printf("Packet #%d rejected.\n", pdu.header.seq_num);
-		#endif
 		// Envoi du ACK.
 		IP_send(pdu_ack, addr);
+		STAT_ADD(socket, pdus_sent, 1);
 	}
 	#ifdef MICTCP_DEBUG_REJECTED
-		else printf("Packet #%d ignored.\n", pdu.header.seq_num);
+		else MICTCP_LOG(MICTCP_LOG_DEBUG, "Packet #%d ignored.", pdu.header.seq_num);
 	#endif
 }
+
+/*
+ * Copie les statistiques d'un socket, sans interrompre le chemin de données.
+ * Retourne 0 si succès, -1 si le descripteur est invalide
+ */
+int mic_tcp_getstats(int socket, mic_tcp_stats* st)
+{
+	if (socket < 0 || socket >= socketd || st == NULL)
+		return -1;
+	st->bytes_sent = STAT_GET(socket, bytes_sent);
+	st->bytes_received = STAT_GET(socket, bytes_received);
+	st->pdus_sent = STAT_GET(socket, pdus_sent);
+	st->pdus_received = STAT_GET(socket, pdus_received);
+	st->losses = STAT_GET(socket, losses);
+	st->retransmits = STAT_GET(socket, retransmits);
+	st->losses_ignored = STAT_GET(socket, losses_ignored);
+	st->duplicates = STAT_GET(socket, duplicates);
+	st->batched = STAT_GET(socket, batched);
+	st->bytes_saved = STAT_GET(socket, bytes_saved);
+	st->rtt_min = STAT_GET(socket, rtt_min);
+	st->rtt_avg = STAT_GET(socket, rtt_avg);
+	st->rtt_var = STAT_GET(socket, rtt_var);
+	st->window = STAT_GET(socket, window);
+	st->queue = (unsigned long)app_buffer_count(socket);
+	st->pacing_delay = STAT_GET(socket, pacing_delay);
+	return 0;
+}
+
+/*
+ * Copie l'histogramme d'une latence d'un socket, sans interrompre les mesures.
+ * Retourne 0 si succès, -1 en cas d'erreur
+ */
+int mic_tcp_gethist(int socket, mic_tcp_latency latency, mictcp_hist* hist)
+{
+	if (socket < 0 || socket >= socketd || latency < 0 || latency >= LATENCIES || hist == NULL)
+		return -1;
+	mictcp_hist_reset(hist);
+	mictcp_hist_merge(hist, &latencies[socket][latency]);
+	return 0;
+}
+
+/*
+ * Modifie une option d'un socket (OPT_LOSS_RATE s'applique à tout le processus).
+ * Retourne 0 si succès, -1 si le socket, l'option ou la valeur est invalide
+ */
+int mic_tcp_setsockopt(int socket, mic_tcp_option option, int value)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || option < 0 || option >= OPTIONS || !option_valid(option, value))
+		return -1;
+	if (option == OPT_LOSS_RATE)
+	{
+		set_loss_rate(value);
+		return 0;
+	}
+	options[socket][option] = value;
+	// Sans regroupement, les messages en attente partent aussitôt.
+	if (option == OPT_CORK && value == 0)
+		mic_tcp_flush(socket);
+	// Une nouvelle fenêtre change la distance de perte d'une connexion établie.
+	if (option == OPT_WINDOW)
+	{
+		STAT_SET(socket, window, value);
+		int k;
+		if (sockets[socket].state == ESTABLISHED)
+			for (k = 0; k < MICTCP_STREAMS; k++)
+				loss_distance_max[socket][k] = loss_distance_max_from_reliability(socket, reliabilities[socket][k]);
+	}
+	return 0;
+}
+
+/*
+ * Fixe la fiabilité partielle proposée pour un flux, avant mic_tcp_connect
+ * (les flux sans valeur propre utilisent OPT_RELIABILITY).
+ * Retourne 0 si succès, -1 en cas d'erreur
+ */
+int mic_tcp_set_stream_reliability(int socket, int stream, int reliability)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || sockets[socket].state != IDLE || !stream_valid(stream)
+		|| !option_valid(OPT_RELIABILITY, reliability))
+		return -1;
+	proposals[socket][stream] = reliability;
+	return 0;
+}
+
+/*
+ * Lis une option d'un socket.
+ * Retourne 0 si succès, -1 en cas d'erreur
+ */
+int mic_tcp_getsockopt(int socket, mic_tcp_option option, int* value)
+{
+	MICTCP_DEBUG_FUNCTION;
+	if (socket < 0 || socket >= socketd || option < 0 || option >= OPTIONS || value == NULL)
+		return -1;
+	if (option == OPT_LOSS_RATE)
+		*value = get_loss_rate();
+	// Une fois la connexion établie, la MSS et la compression lues sont celles négociées.
+	else if (option == OPT_MSS && sockets[socket].state == ESTABLISHED)
+		*value = mss[socket];
+	else if (option == OPT_COMPRESS && sockets[socket].state == ESTABLISHED)
+		*value = compression[socket];
+	else
+		*value = options[socket][option];
+	return 0;
+}